@@ -0,0 +1,33 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+#define MAX_VIEWS 8
+
+struct DrawCommand {
+    uint count, instanceCount, firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 5) readonly buffer Commands { DrawCommand commands[]; };
+// per view: the number of non-empty commands, then meshCount command slots
+// of which the first drawCounts[view] are filled
+layout (std430, binding = 7) buffer Compacted {
+    uint drawCounts[MAX_VIEWS];
+    DrawCommand compacted[];
+};
+
+uniform uint meshCount;
+// the views [firstView, firstView + viewCount) are compacted
+uniform int firstView;
+uniform int viewCount;
+
+void main()
+{
+    uint command = uint(firstView) * meshCount + gl_GlobalInvocationID.x;
+    if (gl_GlobalInvocationID.x >= uint(viewCount) * meshCount || commands[command].instanceCount == 0u)
+        return;
+    uint view = command / meshCount;
+    uint slot = atomicAdd(drawCounts[view], 1u);
+    compacted[view * meshCount + slot] = commands[command];
+}
\ No newline at end of file
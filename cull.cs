@@ -0,0 +1,133 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+#define MAX_VIEWS 8
+
+struct DrawCommand {
+    uint count, instanceCount, firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// world bounds as ten arrays of entityCount floats:
+// sphere x, y, z, radius, box min x, y, z, box max x, y, z
+layout (std430, binding = 2) readonly buffer Bounds { float bounds[]; };
+// mesh, material and flags as three arrays of entityCount
+layout (std430, binding = 3) readonly buffer Entities { uint entities[]; };
+// one command per view and mesh; instanceCount starts at zero
+layout (std430, binding = 5) buffer Commands { DrawCommand commands[]; };
+// each command's baseInstance points at its own range of this list; the
+// range from rejectedBase holds the count and the entities view 0 rejected
+// as occluded in the first phase
+layout (std430, binding = 6) buffer Instances { uint instances[]; };
+
+uniform uint entityCount;
+uniform uint meshCount;
+uniform int viewCount;
+// normalized frustum planes pointing inwards, six per view
+uniform vec4 planes[MAX_VIEWS * 6];
+// a view draws entities with any of its mask's flags and none of its exclude flags
+uniform uint viewMasks[MAX_VIEWS];
+uniform uint viewExcludes[MAX_VIEWS];
+
+// 0: frustum test of every view, view 0 also against the previous frame's
+// pyramid; 1: re-test the rejected entities against this frame's pyramid
+uniform int phase;
+uniform bool occlusion;
+uniform uint lateView;
+uniform uint rejectedBase;
+// max-depth pyramid and the view-projection of the depth it was built from
+uniform sampler2D depthPyramid;
+uniform mat4 pyramidViewProjection;
+
+float bound(uint array, uint i)
+{
+    return bounds[array * entityCount + i];
+}
+
+void append(uint view, uint entity)
+{
+    uint command = view * meshCount + entities[entity];
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    instances[commands[command].baseInstance + slot] = entity;
+}
+
+// true when the box lies behind everything the pyramid recorded over its
+// screen footprint
+bool occluded(vec3 boxMin, vec3 boxMax)
+{
+    vec2 uvMin = vec2(1.0), uvMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int c = 0; c < 8; ++c)
+    {
+        vec3 corner = mix(boxMin, boxMax, bvec3((c & 1) != 0, (c & 2) != 0, (c & 4) != 0));
+        vec4 clip = pyramidViewProjection * vec4(corner, 1.0);
+        // crossing the near plane: keep it
+        if (clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+        uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+
+    // the footprint in level 0 texels, then the first level where it spans at most 2x2 texels
+    ivec2 size = textureSize(depthPyramid, 0);
+    ivec2 t0 = clamp(ivec2(uvMin * vec2(size)), ivec2(0), size - 1);
+    ivec2 t1 = clamp(ivec2(uvMax * vec2(size)), ivec2(0), size - 1);
+    int levels = textureQueryLevels(depthPyramid);
+    int level = 0;
+    while (level < levels - 1 && any(greaterThan((t1 >> level) - (t0 >> level), ivec2(1))))
+        ++level;
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 l0 = min(t0 >> level, levelSize - 1);
+    ivec2 l1 = min(t1 >> level, levelSize - 1);
+    float depth = max(max(texelFetch(depthPyramid, l0, level).r, texelFetch(depthPyramid, ivec2(l1.x, l0.y), level).r),
+                      max(texelFetch(depthPyramid, ivec2(l0.x, l1.y), level).r, texelFetch(depthPyramid, l1, level).r));
+    return nearest > depth;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (phase == 1)
+    {
+        if (i >= instances[rejectedBase])
+            return;
+        i = instances[rejectedBase + 1u + i];
+        if (!occluded(vec3(bound(4u, i), bound(5u, i), bound(6u, i)), vec3(bound(7u, i), bound(8u, i), bound(9u, i))))
+            append(lateView, i);
+        return;
+    }
+
+    if (i >= entityCount)
+        return;
+    vec4 sphere = vec4(bound(0u, i), bound(1u, i), bound(2u, i), bound(3u, i));
+    vec3 boxMin = vec3(bound(4u, i), bound(5u, i), bound(6u, i));
+    vec3 boxMax = vec3(bound(7u, i), bound(8u, i), bound(9u, i));
+    uint flags = entities[2u * entityCount + i];
+
+    for (int v = 0; v < viewCount; ++v)
+    {
+        if ((flags & viewMasks[v]) == 0u || (flags & viewExcludes[v]) != 0u)
+            continue;
+        // the sphere and the box corner furthest along each normal must be inside
+        bool visible = true;
+        for (int p = 0; p < 6 && visible; ++p)
+        {
+            vec4 plane = planes[v * 6 + p];
+            vec3 corner = mix(boxMin, boxMax, greaterThan(plane.xyz, vec3(0.0)));
+            visible = dot(plane.xyz, sphere.xyz) + plane.w + sphere.w >= 0.0
+                   && dot(plane.xyz, corner) + plane.w >= 0.0;
+        }
+        if (!visible)
+            continue;
+        if (v == 0 && occlusion && occluded(boxMin, boxMax))
+        {
+            uint slot = atomicAdd(instances[rejectedBase], 1u);
+            instances[rejectedBase + 1u + slot] = i;
+            continue;
+        }
+        append(uint(v), i);
+    }
+}
\ No newline at end of file
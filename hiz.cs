@@ -0,0 +1,31 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// one level of the max-depth pyramid
+layout (r32f, binding = 0) writeonly uniform image2D level;
+// the depth buffer for level 0, the pyramid's previous level otherwise
+uniform sampler2D source;
+uniform int sourceLevel;
+uniform bool copy;
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, imageSize(level))))
+        return;
+    if (copy)
+    {
+        imageStore(level, p, vec4(texelFetch(source, p, 0).r));
+        return;
+    }
+    // each texel keeps the farthest of the 2x2 below it; with an odd source
+    // size the last row/column also takes in the texel the halving drops
+    ivec2 size = textureSize(source, sourceLevel);
+    ivec2 first = p * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(first + 2, size - 1)), size - 1);
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            depth = max(depth, texelFetch(source, ivec2(x, y), sourceLevel).r);
+    imageStore(level, p, vec4(depth));
+}
\ No newline at end of file
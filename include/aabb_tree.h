@@ -0,0 +1,513 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "culling.h"
+
+struct AABB
+{
+    glm::vec3 min, max;
+
+    bool contains(const AABB &other) const
+    {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+               other.max.x <= max.x && other.max.y <= max.y && other.max.z <= max.z;
+    }
+    bool overlaps(const AABB &other) const
+    {
+        return min.x <= other.max.x && other.min.x <= max.x &&
+               min.y <= other.max.y && other.min.y <= max.y &&
+               min.z <= other.max.z && other.min.z <= max.z;
+    }
+    float surfaceArea() const
+    {
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    static AABB merge(const AABB &a, const AABB &b)
+    {
+        return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+    // entry distance of the ray along dir (given as 1/dir), or a negative value on a miss
+    float rayEntry(const glm::vec3 &origin, const glm::vec3 &invDir, float maxT) const
+    {
+        glm::vec3 t0 = (min - origin) * invDir;
+        glm::vec3 t1 = (max - origin) * invDir;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+        return enter <= exit ? enter : -1.0f;
+    }
+};
+
+// Dynamic bounding volume hierarchy. Leaves store a box enlarged by a margin,
+// so small movements only need a containment check; larger ones reinsert the
+// leaf along the cheapest surface-area path and rebalance with tree rotations.
+// Bulk loads go through build(), a top-down median split that replaces the
+// whole tree at once. Every query walks the tree in O(log n) for small results.
+class AABBTree
+{
+public:
+    static constexpr int NULL_NODE = -1;
+    // enlargement of leaf boxes, in world units
+    float margin = 0.1f;
+
+    AABBTree() : root(NULL_NODE), freeList(NULL_NODE), leafCount(0) {}
+
+    size_t size() const { return leafCount; }
+    int height() const { return root == NULL_NODE ? 0 : nodes[root].height; }
+
+    void clear()
+    {
+        nodes.clear();
+        root = freeList = NULL_NODE;
+        leafCount = 0;
+    }
+
+    int createProxy(const AABB &box, uint32_t userData)
+    {
+        int proxy = allocateNode();
+        nodes[proxy].box = fatten(box);
+        nodes[proxy].userData = userData;
+        nodes[proxy].height = 0;
+        insertLeaf(proxy);
+        ++leafCount;
+        return proxy;
+    }
+
+    void destroyProxy(int proxy)
+    {
+        removeLeaf(proxy);
+        freeNode(proxy);
+        --leafCount;
+    }
+
+    // returns true when the leaf had to be reinserted
+    bool moveProxy(int proxy, const AABB &box)
+    {
+        if (nodes[proxy].box.contains(box))
+            return false;
+        removeLeaf(proxy);
+        nodes[proxy].box = fatten(box);
+        insertLeaf(proxy);
+        return true;
+    }
+
+    uint32_t getUserData(int proxy) const { return nodes[proxy].userData; }
+    void setUserData(int proxy, uint32_t userData) { nodes[proxy].userData = userData; }
+    const AABB &getFatAABB(int proxy) const { return nodes[proxy].box; }
+
+    // replace the tree by a balanced build over count boxes; proxies[i]
+    // receives the leaf created for boxes[i]
+    // ------------------------------------------------------------------------
+    void build(const AABB *boxes, const uint32_t *userData, size_t count, int *proxies)
+    {
+        clear();
+        if (count == 0)
+            return;
+        nodes.reserve(2 * count);
+        std::vector<int> leaves(count);
+        std::vector<glm::vec3> centers(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            int leaf = allocateNode();
+            nodes[leaf].box = fatten(boxes[i]);
+            nodes[leaf].userData = userData[i];
+            nodes[leaf].height = 0;
+            leaves[i] = proxies[i] = leaf;
+            centers[i] = 0.5f * (boxes[i].min + boxes[i].max);
+        }
+        leafCount = count;
+        root = buildRange(leaves.data(), centers, 0, count);
+        nodes[root].parent = NULL_NODE;
+    }
+
+    // every leaf whose box overlaps the query box; visit(userData) returns false to stop
+    template <typename Visit>
+    void queryAABB(const AABB &box, Visit visit) const
+    {
+        traverse([&](const AABB &node) { return node.overlaps(box); }, visit);
+    }
+
+    // every leaf whose box touches the sphere, e.g. the objects a light reaches
+    template <typename Visit>
+    void querySphere(const glm::vec3 &center, float radius, Visit visit) const
+    {
+        float radius2 = radius * radius;
+        traverse([&](const AABB &node) {
+            glm::vec3 d = glm::clamp(center, node.min, node.max) - center;
+            return glm::dot(d, d) <= radius2;
+        }, visit);
+    }
+
+    // every leaf whose box intersects the frustum; subtrees entirely inside
+    // are reported without further plane tests
+    template <typename Visit>
+    void queryFrustum(const Frustum &frustum, Visit visit) const
+    {
+        if (root == NULL_NODE)
+            return;
+        std::vector<std::pair<int, bool>> stack;
+        stack.push_back(std::make_pair(root, false));
+        while (!stack.empty())
+        {
+            int id = stack.back().first;
+            bool inside = stack.back().second;
+            stack.pop_back();
+            const Node &node = nodes[id];
+            if (!inside)
+            {
+                inside = true;
+                bool outside = false;
+                for (const glm::vec4 &p : frustum.planes)
+                {
+                    glm::vec3 n(p);
+                    glm::vec3 positive(n.x > 0.0f ? node.box.max.x : node.box.min.x, n.y > 0.0f ? node.box.max.y : node.box.min.y, n.z > 0.0f ? node.box.max.z : node.box.min.z);
+                    glm::vec3 negative(n.x > 0.0f ? node.box.min.x : node.box.max.x, n.y > 0.0f ? node.box.min.y : node.box.max.y, n.z > 0.0f ? node.box.min.z : node.box.max.z);
+                    if (glm::dot(n, positive) + p.w < 0.0f)
+                    {
+                        outside = true;
+                        break;
+                    }
+                    if (glm::dot(n, negative) + p.w < 0.0f)
+                        inside = false;
+                }
+                if (outside)
+                    continue;
+            }
+            if (node.isLeaf())
+            {
+                if (!visit(node.userData))
+                    return;
+                continue;
+            }
+            stack.push_back(std::make_pair(node.child1, inside));
+            stack.push_back(std::make_pair(node.child2, inside));
+        }
+    }
+
+    // closest hit along the ray: hit(userData, maxT) returns the exact hit
+    // distance of that leaf's object or a negative value on a miss. Returns
+    // the hit distance (negative if nothing was hit) and the hit's userData.
+    // ------------------------------------------------------------------------
+    template <typename Hit>
+    float raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, Hit hit, uint32_t &hitUserData) const
+    {
+        float best = maxT;
+        bool found = false;
+        if (root == NULL_NODE)
+            return -1.0f;
+        glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        std::vector<int> stack;
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            int id = stack.back();
+            stack.pop_back();
+            const Node &node = nodes[id];
+            if (node.box.rayEntry(origin, invDir, best) < 0.0f)
+                continue;
+            if (node.isLeaf())
+            {
+                float t = hit(node.userData, best);
+                if (t >= 0.0f && t <= best)
+                {
+                    best = t;
+                    hitUserData = node.userData;
+                    found = true;
+                }
+                continue;
+            }
+            // visit the nearer child first so the far one is usually clipped
+            float t1 = nodes[node.child1].box.rayEntry(origin, invDir, best);
+            float t2 = nodes[node.child2].box.rayEntry(origin, invDir, best);
+            if (t1 >= 0.0f && t2 >= 0.0f)
+            {
+                stack.push_back(t1 < t2 ? node.child2 : node.child1);
+                stack.push_back(t1 < t2 ? node.child1 : node.child2);
+            }
+            else if (t1 >= 0.0f)
+                stack.push_back(node.child1);
+            else if (t2 >= 0.0f)
+                stack.push_back(node.child2);
+        }
+        return found ? best : -1.0f;
+    }
+
+private:
+    struct Node
+    {
+        AABB box;
+        int parent;     // doubles as the next free node while unused
+        int child1, child2;
+        int height;     // 0 for leaves, -1 for free nodes
+        uint32_t userData;
+        bool isLeaf() const { return child1 == NULL_NODE; }
+    };
+
+    std::vector<Node> nodes;
+    int root;
+    int freeList;
+    size_t leafCount;
+
+    AABB fatten(const AABB &box) const
+    {
+        return { box.min - glm::vec3(margin), box.max + glm::vec3(margin) };
+    }
+
+    int allocateNode()
+    {
+        int id;
+        if (freeList != NULL_NODE)
+        {
+            id = freeList;
+            freeList = nodes[id].parent;
+        }
+        else
+        {
+            id = (int)nodes.size();
+            nodes.push_back(Node());
+        }
+        Node &node = nodes[id];
+        node.parent = node.child1 = node.child2 = NULL_NODE;
+        node.height = 0;
+        node.userData = 0;
+        return id;
+    }
+
+    void freeNode(int id)
+    {
+        nodes[id].parent = freeList;
+        nodes[id].height = -1;
+        freeList = id;
+    }
+
+    template <typename Accept, typename Visit>
+    void traverse(Accept accept, Visit visit) const
+    {
+        if (root == NULL_NODE)
+            return;
+        std::vector<int> stack;
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            if (!accept(node.box))
+                continue;
+            if (node.isLeaf())
+            {
+                if (!visit(node.userData))
+                    return;
+                continue;
+            }
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+
+    int buildRange(int *leaves, std::vector<glm::vec3> &centers, size_t begin, size_t end)
+    {
+        if (end - begin == 1)
+            return leaves[begin];
+        // split at the median centroid along the widest axis
+        glm::vec3 lo = centers[begin], hi = centers[begin];
+        for (size_t i = begin + 1; i < end; ++i)
+        {
+            lo = glm::min(lo, centers[i]);
+            hi = glm::max(hi, centers[i]);
+        }
+        glm::vec3 extent = hi - lo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        size_t mid = begin + (end - begin) / 2;
+        std::vector<size_t> order(end - begin);
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = begin + i;
+        std::nth_element(order.begin(), order.begin() + (mid - begin), order.end(), [&](size_t a, size_t b) {
+            return centers[a][axis] < centers[b][axis];
+        });
+        std::vector<int> sortedLeaves(order.size());
+        std::vector<glm::vec3> sortedCenters(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            sortedLeaves[i] = leaves[order[i]];
+            sortedCenters[i] = centers[order[i]];
+        }
+        std::copy(sortedLeaves.begin(), sortedLeaves.end(), leaves + begin);
+        std::copy(sortedCenters.begin(), sortedCenters.end(), centers.begin() + begin);
+
+        int child1 = buildRange(leaves, centers, begin, mid);
+        int child2 = buildRange(leaves, centers, mid, end);
+        int parent = allocateNode();
+        Node &node = nodes[parent];
+        node.child1 = child1;
+        node.child2 = child2;
+        node.box = AABB::merge(nodes[child1].box, nodes[child2].box);
+        node.height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[child1].parent = parent;
+        nodes[child2].parent = parent;
+        return parent;
+    }
+
+    void insertLeaf(int leaf)
+    {
+        if (root == NULL_NODE)
+        {
+            root = leaf;
+            nodes[root].parent = NULL_NODE;
+            return;
+        }
+
+        // descend towards the sibling with the lowest surface-area cost
+        AABB leafBox = nodes[leaf].box;
+        int index = root;
+        while (!nodes[index].isLeaf())
+        {
+            int child1 = nodes[index].child1;
+            int child2 = nodes[index].child2;
+            float area = nodes[index].box.surfaceArea();
+            float combinedArea = AABB::merge(nodes[index].box, leafBox).surfaceArea();
+            // cost of pairing the leaf with this node, and the inherited
+            // cost of pushing it further down
+            float cost = 2.0f * combinedArea;
+            float inheritance = 2.0f * (combinedArea - area);
+            float cost1 = descendCost(child1, leafBox) + inheritance;
+            float cost2 = descendCost(child2, leafBox) + inheritance;
+            if (cost < cost1 && cost < cost2)
+                break;
+            index = cost1 < cost2 ? child1 : child2;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].box = AABB::merge(leafBox, nodes[sibling].box);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent != NULL_NODE)
+        {
+            if (nodes[oldParent].child1 == sibling)
+                nodes[oldParent].child1 = newParent;
+            else
+                nodes[oldParent].child2 = newParent;
+        }
+        else
+            root = newParent;
+
+        refitUpwards(nodes[leaf].parent);
+    }
+
+    float descendCost(int child, const AABB &leafBox) const
+    {
+        AABB box = AABB::merge(leafBox, nodes[child].box);
+        if (nodes[child].isLeaf())
+            return box.surfaceArea();
+        return box.surfaceArea() - nodes[child].box.surfaceArea();
+    }
+
+    void removeLeaf(int leaf)
+    {
+        if (leaf == root)
+        {
+            root = NULL_NODE;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        if (grandParent != NULL_NODE)
+        {
+            if (nodes[grandParent].child1 == parent)
+                nodes[grandParent].child1 = sibling;
+            else
+                nodes[grandParent].child2 = sibling;
+            nodes[sibling].parent = grandParent;
+            freeNode(parent);
+            refitUpwards(grandParent);
+        }
+        else
+        {
+            root = sibling;
+            nodes[sibling].parent = NULL_NODE;
+            freeNode(parent);
+        }
+    }
+
+    // fix heights and boxes from index to the root, rebalancing on the way
+    void refitUpwards(int index)
+    {
+        while (index != NULL_NODE)
+        {
+            index = balance(index);
+            int child1 = nodes[index].child1;
+            int child2 = nodes[index].child2;
+            nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+            nodes[index].box = AABB::merge(nodes[child1].box, nodes[child2].box);
+            index = nodes[index].parent;
+        }
+    }
+
+    // rotate the taller grandchild up when the subtrees of A differ in height
+    // by more than one; returns the new subtree root
+    int balance(int iA)
+    {
+        Node &A = nodes[iA];
+        if (A.isLeaf() || A.height < 2)
+            return iA;
+        int iB = A.child1;
+        int iC = A.child2;
+        int diff = nodes[iC].height - nodes[iB].height;
+        if (diff > 1)
+            return rotate(iA, iC, iB, true);
+        if (diff < -1)
+            return rotate(iA, iB, iC, false);
+        return iA;
+    }
+
+    // promote child iUp of iA, which replaces A in the tree; iOther stays under A
+    int rotate(int iA, int iUp, int iOther, bool upIsChild2)
+    {
+        int iF = nodes[iUp].child1;
+        int iG = nodes[iUp].child2;
+
+        nodes[iUp].child1 = iA;
+        nodes[iUp].parent = nodes[iA].parent;
+        nodes[iA].parent = iUp;
+        if (nodes[iUp].parent != NULL_NODE)
+        {
+            int p = nodes[iUp].parent;
+            if (nodes[p].child1 == iA)
+                nodes[p].child1 = iUp;
+            else
+                nodes[p].child2 = iUp;
+        }
+        else
+            root = iUp;
+
+        // keep the taller grandchild under the promoted node
+        int keep = nodes[iF].height > nodes[iG].height ? iF : iG;
+        int give = keep == iF ? iG : iF;
+        nodes[iUp].child2 = keep;
+        if (upIsChild2)
+            nodes[iA].child2 = give;
+        else
+            nodes[iA].child1 = give;
+        nodes[give].parent = iA;
+        nodes[iA].box = AABB::merge(nodes[iOther].box, nodes[give].box);
+        nodes[iUp].box = AABB::merge(nodes[iA].box, nodes[keep].box);
+        nodes[iA].height = 1 + std::max(nodes[iOther].height, nodes[give].height);
+        nodes[iUp].height = 1 + std::max(nodes[iA].height, nodes[keep].height);
+        return iUp;
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <glm/glm.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// One frame of a batch run: where its image goes and what it changes in the
+// scene it starts from. Every job starts from the same base state, so its
+// overrides do not carry over to the next one.
+struct RenderJob
+{
+    struct LightOverride
+    {
+        int light;
+        glm::vec3 position;
+    };
+    struct SegmentOverride
+    {
+        int object;
+        int segments;
+    };
+    // field 0..2 sets the ambient, diffuse or specular color, 3 the alpha (value.x)
+    struct MaterialOverride
+    {
+        int object;
+        int field;
+        glm::vec3 value;
+    };
+
+    std::string output;
+    // animation time of the frame, in seconds
+    float time = 0.0f;
+    bool overrideCamera = false;
+    glm::vec3 cameraPosition;
+    float yaw = 0.0f, pitch = 0.0f;
+    std::vector<LightOverride> lights;
+    std::vector<SegmentOverride> segments;
+    std::vector<MaterialOverride> materials;
+};
+
+// Read a job file: one job per line, the output path first, then any of
+//   time t
+//   camera x y z yaw pitch
+//   light index x y z
+//   segments object count
+//   ambient|diffuse|specular object r g b
+//   alpha object a
+// where object numbers the selectable objects. Blank lines and lines
+// starting with # are skipped; a malformed line is reported and dropped.
+// Returns false if the file cannot be read.
+inline bool loadRenderJobs(const std::string &path, std::vector<RenderJob> &jobs)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::BATCH:: Failed to read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+    {
+        std::istringstream tokens(line);
+        RenderJob job;
+        if (!(tokens >> job.output) || job.output[0] == '#')
+            continue;
+        bool valid = true;
+        std::string key;
+        while (valid && tokens >> key)
+        {
+            if (key == "time")
+                valid = (bool)(tokens >> job.time);
+            else if (key == "camera")
+            {
+                job.overrideCamera = true;
+                valid = (bool)(tokens >> job.cameraPosition.x >> job.cameraPosition.y >> job.cameraPosition.z >> job.yaw >> job.pitch);
+            }
+            else if (key == "light")
+            {
+                RenderJob::LightOverride light;
+                valid = (bool)(tokens >> light.light >> light.position.x >> light.position.y >> light.position.z);
+                job.lights.push_back(light);
+            }
+            else if (key == "segments")
+            {
+                RenderJob::SegmentOverride segments;
+                valid = (bool)(tokens >> segments.object >> segments.segments) && segments.segments > 0;
+                job.segments.push_back(segments);
+            }
+            else if (key == "ambient" || key == "diffuse" || key == "specular")
+            {
+                RenderJob::MaterialOverride material;
+                material.field = key == "ambient" ? 0 : key == "diffuse" ? 1 : 2;
+                valid = (bool)(tokens >> material.object >> material.value.r >> material.value.g >> material.value.b);
+                job.materials.push_back(material);
+            }
+            else if (key == "alpha")
+            {
+                RenderJob::MaterialOverride material;
+                material.field = 3;
+                material.value = glm::vec3(0.0f);
+                valid = (bool)(tokens >> material.object >> material.value.x);
+                job.materials.push_back(material);
+            }
+            else
+                valid = false;
+        }
+        if (valid)
+            jobs.push_back(job);
+        else
+            std::cout << "ERROR::BATCH:: " << path << ":" << number << ": cannot parse '" << key << "', job skipped" << std::endl;
+    }
+    return true;
+}
+#endif
\ No newline at end of file
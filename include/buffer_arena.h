@@ -0,0 +1,437 @@
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gl_resources.h"
+
+// One large GL buffer carved into many allocations by a two-level
+// segregated fit (TLSF) allocator: free blocks are kept in lists per size
+// class, the first level by power of two and the second splitting each
+// power into SL_COUNT steps, with bitmaps to find a large enough class in
+// constant time. Sizes and offsets count units (a vertex, an index), so an
+// allocation's first() can be passed straight to the draw call. Free
+// neighbours are merged at once; defragment() moves allocations down into
+// earlier holes with glCopyBufferSubData, a budget per call, so free space
+// gathers at the end. A full arena grows into a buffer of twice the size.
+class BufferArena
+{
+public:
+    // allocation handle, stable across moves; 0 is no allocation
+    typedef uint32_t Allocation;
+
+    static constexpr int SL_BITS = 4;
+    static constexpr int SL_COUNT = 1 << SL_BITS;
+    static constexpr int FL_COUNT = 32;
+
+    struct Stats
+    {
+        size_t capacity = 0;      // bytes
+        size_t used = 0;
+        size_t largestFree = 0;
+        size_t allocations = 0;
+        size_t blocks = 0;
+
+        // share of the buffer holding data
+        float occupancy() const { return capacity ? (float)used / capacity : 0.0f; }
+        // share of the free space outside the largest free block
+        float fragmentation() const
+        {
+            size_t free = capacity - used;
+            return free ? 1.0f - (float)largestFree / free : 0.0f;
+        }
+    };
+
+    BufferArena(size_t unitBytes, size_t initialUnits) : unit(unitBytes)
+    {
+        for (auto &classes : heads)
+        {
+            for (uint32_t &head : classes)
+                head = NIL;
+        }
+        grow(initialUnits > 0 ? (uint32_t)initialUnits : 1);
+    }
+
+    ~BufferArena()
+    {
+        glDeleteBuffers(1, &bufferId);
+    }
+
+    BufferArena(const BufferArena &) = delete;
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    GLuint buffer() const
+    {
+        return bufferId;
+    }
+
+    // reserve count units and fill them from data when given; returns 0 if
+    // count does not fit the 32-bit offsets
+    // ------------------------------------------------------------------------
+    Allocation allocate(size_t count, const void *data)
+    {
+        uint32_t size = count > 0 ? (uint32_t)count : 1;
+        uint32_t needed = classSize(size);
+        if (count > 0xffffffffu || needed == 0 || needed > 0xffffffffu - capacity)
+            return 0;
+        uint32_t b = findFree(size);
+        if (b == NIL)
+        {
+            // findFree looks in classes whose every block fits, so the new
+            // room must reach the class size, not just the size
+            grow(needed);
+            b = findFree(size);
+        }
+        assert(b != NIL);
+        removeFree(b);
+        split(b, size);
+        blocks[b].free = false;
+
+        Allocation id;
+        if (!unusedOwners.empty())
+        {
+            id = unusedOwners.back();
+            unusedOwners.pop_back();
+            owners[id - 1] = b;
+        }
+        else
+        {
+            owners.push_back(b);
+            id = (Allocation)owners.size();
+        }
+        blocks[b].owner = id;
+        if (data)
+            updateBuffer(bufferId, (size_t)blocks[b].offset * unit, count * unit, data);
+        return id;
+    }
+
+    void release(Allocation id)
+    {
+        if (id == 0)
+            return;
+        freeBlock(owners[id - 1]);
+        unusedOwners.push_back(id);
+    }
+
+    // offset in units, e.g. the base vertex
+    size_t first(Allocation id) const
+    {
+        return blocks[owners[id - 1]].offset;
+    }
+
+    size_t byteOffset(Allocation id) const
+    {
+        return first(id) * unit;
+    }
+
+    // move allocations from the back of the buffer into the first hole that
+    // fits in front of them, copying at most budget bytes; returns the bytes
+    // moved. first() reports the new place right away. The holes are listed
+    // once per call in buffer order with the running maximum of their sizes,
+    // so the first one that fits is a binary search away
+    // ------------------------------------------------------------------------
+    size_t defragment(size_t budget)
+    {
+        holes.clear();
+        largest.clear();
+        for (uint32_t b = HEAD; b != NIL; b = blocks[b].next)
+        {
+            if (blocks[b].free)
+            {
+                holes.push_back(b);
+                largest.push_back(std::max(largest.empty() ? 0u : largest.back(), blocks[b].size));
+            }
+        }
+
+        size_t moved = 0;
+        // holes [0, limit) lie in front of the source
+        size_t limit = holes.size();
+        uint32_t source = tail;
+        while (source != NIL && moved < budget)
+        {
+            uint32_t previous = blocks[source].prev;
+            while (limit > 0 && (holes[limit - 1] == NIL || blocks[holes[limit - 1]].offset >= blocks[source].offset))
+                --limit;
+            uint32_t size = blocks[source].size;
+            size_t h = std::lower_bound(largest.begin(), largest.begin() + limit, size) - largest.begin();
+            if (!blocks[source].free && h < limit)
+            {
+                uint32_t target = holes[h];
+                removeFree(target);
+                split(target, size);
+                copyBuffer(bufferId, (size_t)blocks[source].offset * unit, bufferId, (size_t)blocks[target].offset * unit, (size_t)size * unit);
+                Allocation id = blocks[source].owner;
+                blocks[target].free = false;
+                blocks[target].owner = id;
+                owners[id - 1] = target;
+                // what is left of the hole is the block split() put after it
+                uint32_t rest = blocks[target].next;
+                holes[h] = rest != NIL && blocks[rest].free ? rest : NIL;
+                for (size_t i = h; i < limit; ++i)
+                    largest[i] = std::max(i > 0 ? largest[i - 1] : 0u, holes[i] != NIL ? blocks[holes[i]].size : 0u);
+                // the source may merge with its neighbours, so step from
+                // the block before it, which lies before any merge
+                freeBlock(source);
+                moved += (size_t)size * unit;
+            }
+            source = previous;
+        }
+        return moved;
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.capacity = (size_t)capacity * unit;
+        s.allocations = owners.size() - unusedOwners.size();
+        for (uint32_t b = HEAD; b != NIL; b = blocks[b].next)
+        {
+            size_t bytes = (size_t)blocks[b].size * unit;
+            if (!blocks[b].free)
+                s.used += bytes;
+            else if (bytes > s.largestFree)
+                s.largestFree = bytes;
+            ++s.blocks;
+        }
+        return s;
+    }
+
+private:
+    static constexpr uint32_t NIL = 0xffffffffu;
+    // the block at offset 0 never merges into an earlier one, so keeps its index
+    static constexpr uint32_t HEAD = 0;
+
+    // a run of units in physical order, linked to its neighbours and, when
+    // free, into the list of its size class
+    struct Block
+    {
+        uint32_t offset, size;
+        uint32_t prev, next;
+        uint32_t prevFree, nextFree;
+        Allocation owner;
+        bool free;
+    };
+
+    size_t unit;
+    GLuint bufferId = 0;
+    uint32_t capacity = 0;
+    std::vector<Block> blocks;
+    std::vector<uint32_t> unusedBlocks;
+    // block of each allocation, indexed by id - 1
+    std::vector<uint32_t> owners;
+    std::vector<Allocation> unusedOwners;
+    uint32_t tail = NIL;
+    uint32_t flBitmap = 0;
+    uint32_t slBitmap[FL_COUNT] = {};
+    uint32_t heads[FL_COUNT][SL_COUNT];
+    // defragment()'s holes in buffer order and the largest of each prefix
+    std::vector<uint32_t> holes;
+    std::vector<uint32_t> largest;
+
+    static int highestBit(uint32_t x)
+    {
+#if defined(__GNUC__)
+        return 31 - __builtin_clz(x);
+#else
+        int bit = 0;
+        while (x >>= 1)
+            ++bit;
+        return bit;
+#endif
+    }
+
+    static int lowestBit(uint32_t x)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctz(x);
+#else
+        int bit = 0;
+        while (!(x & 1u))
+        {
+            x >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    // size class of a block of size units
+    static void mapping(uint32_t size, int &fl, int &sl)
+    {
+        if (size < (uint32_t)SL_COUNT)
+        {
+            fl = 0;
+            sl = (int)size;
+            return;
+        }
+        int log = highestBit(size);
+        fl = log - SL_BITS + 1;
+        sl = (int)(size >> (log - SL_BITS)) - SL_COUNT;
+    }
+
+    // size rounded up to the first class whose every block holds it, 0 if
+    // that overflows
+    static uint32_t classSize(uint32_t size)
+    {
+        if (size < (uint32_t)SL_COUNT)
+            return size;
+        uint32_t round = (1u << (highestBit(size) - SL_BITS)) - 1;
+        return size > 0xffffffffu - round ? 0 : size + round;
+    }
+
+    // a free block of at least size units, from the first class whose every
+    // block is large enough
+    uint32_t findFree(uint32_t size) const
+    {
+        size = classSize(size);
+        if (size == 0)
+            return NIL;
+        int fl, sl;
+        mapping(size, fl, sl);
+        uint32_t slMap = slBitmap[fl] & (~0u << sl);
+        if (!slMap)
+        {
+            uint32_t flMap = fl + 1 < FL_COUNT ? flBitmap & (~0u << (fl + 1)) : 0;
+            if (!flMap)
+                return NIL;
+            fl = lowestBit(flMap);
+            slMap = slBitmap[fl];
+        }
+        return heads[fl][lowestBit(slMap)];
+    }
+
+    void insertFree(uint32_t b)
+    {
+        int fl, sl;
+        mapping(blocks[b].size, fl, sl);
+        blocks[b].free = true;
+        blocks[b].prevFree = NIL;
+        blocks[b].nextFree = heads[fl][sl];
+        if (heads[fl][sl] != NIL)
+            blocks[heads[fl][sl]].prevFree = b;
+        heads[fl][sl] = b;
+        flBitmap |= 1u << fl;
+        slBitmap[fl] |= 1u << sl;
+    }
+
+    void removeFree(uint32_t b)
+    {
+        int fl, sl;
+        mapping(blocks[b].size, fl, sl);
+        Block &block = blocks[b];
+        if (block.prevFree != NIL)
+            blocks[block.prevFree].nextFree = block.nextFree;
+        else
+            heads[fl][sl] = block.nextFree;
+        if (block.nextFree != NIL)
+            blocks[block.nextFree].prevFree = block.prevFree;
+        if (heads[fl][sl] == NIL)
+        {
+            slBitmap[fl] &= ~(1u << sl);
+            if (!slBitmap[fl])
+                flBitmap &= ~(1u << fl);
+        }
+        block.free = false;
+    }
+
+    uint32_t newBlock(uint32_t offset, uint32_t size)
+    {
+        Block block = { offset, size, NIL, NIL, NIL, NIL, 0, false };
+        if (!unusedBlocks.empty())
+        {
+            uint32_t b = unusedBlocks.back();
+            unusedBlocks.pop_back();
+            blocks[b] = block;
+            return b;
+        }
+        blocks.push_back(block);
+        return (uint32_t)blocks.size() - 1;
+    }
+
+    // cut block b, already out of the free lists, to size units; the rest
+    // becomes a free block right after it
+    void split(uint32_t b, uint32_t size)
+    {
+        if (blocks[b].size <= size)
+            return;
+        uint32_t rest = newBlock(blocks[b].offset + size, blocks[b].size - size);
+        blocks[b].size = size;
+        blocks[rest].prev = b;
+        blocks[rest].next = blocks[b].next;
+        if (blocks[rest].next != NIL)
+            blocks[blocks[rest].next].prev = rest;
+        else
+            tail = rest;
+        blocks[b].next = rest;
+        insertFree(rest);
+    }
+
+    // merge b's successor into b and recycle it
+    void absorbNext(uint32_t b)
+    {
+        uint32_t next = blocks[b].next;
+        blocks[b].size += blocks[next].size;
+        blocks[b].next = blocks[next].next;
+        if (blocks[b].next != NIL)
+            blocks[blocks[b].next].prev = b;
+        else
+            tail = b;
+        unusedBlocks.push_back(next);
+    }
+
+    void freeBlock(uint32_t b)
+    {
+        blocks[b].owner = 0;
+        uint32_t next = blocks[b].next;
+        if (next != NIL && blocks[next].free)
+        {
+            removeFree(next);
+            absorbNext(b);
+        }
+        uint32_t prev = blocks[b].prev;
+        if (prev != NIL && blocks[prev].free)
+        {
+            removeFree(prev);
+            absorbNext(prev);
+            b = prev;
+        }
+        insertFree(b);
+    }
+
+    // move everything into a buffer with room for at least units more
+    void grow(uint32_t units)
+    {
+        uint32_t extra = capacity > units ? capacity : units;
+        GLuint grown = createBuffer((size_t)(capacity + extra) * unit, NULL, true);
+        if (bufferId)
+        {
+            copyBuffer(bufferId, 0, grown, 0, (size_t)capacity * unit);
+            glDeleteBuffers(1, &bufferId);
+        }
+        bufferId = grown;
+
+        if (tail != NIL && blocks[tail].free)
+        {
+            removeFree(tail);
+            blocks[tail].size += extra;
+            insertFree(tail);
+        }
+        else
+        {
+            uint32_t b = newBlock(capacity, extra);
+            blocks[b].prev = tail;
+            if (tail != NIL)
+                blocks[tail].next = b;
+            tail = b;
+            insertFree(b);
+        }
+        capacity += extra;
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,171 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CULLING_X86 1
+#endif
+
+#include "job_system.h"
+
+// the six planes of a view-projection matrix, normalized, pointing inwards
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    static Frustum fromMatrix(const glm::mat4 &m)
+    {
+        // rows of the column-major matrix (Gribb/Hartmann)
+        glm::vec4 row[4];
+        for (int r = 0; r < 4; ++r)
+            row[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+        Frustum f;
+        f.planes[0] = row[3] + row[0];    // left
+        f.planes[1] = row[3] - row[0];    // right
+        f.planes[2] = row[3] + row[1];    // bottom
+        f.planes[3] = row[3] - row[1];    // top
+        f.planes[4] = row[3] + row[2];    // near
+        f.planes[5] = row[3] - row[2];    // far
+        for (glm::vec4 &p : f.planes)
+            p /= glm::length(glm::vec3(p));
+        return f;
+    }
+};
+
+// world bounds of every object as parallel arrays
+struct BoundsArrays
+{
+    const float *sphereX, *sphereY, *sphereZ, *sphereRadius;
+    const float *minX, *minY, *minZ, *maxX, *maxY, *maxZ;
+};
+
+struct CullStats
+{
+    size_t tested = 0;
+    size_t visible = 0;
+    size_t culled() const { return tested - visible; }
+};
+
+// Frustum culling over SoA bounds. An object is visible when both its bounding
+// sphere and its box (tested at the corner furthest along each plane normal)
+// are inside or crossing all six planes. Eight objects are tested per step with
+// AVX2 when the CPU has it, four with SSE otherwise.
+class FrustumCuller
+{
+public:
+    // objects per job; smaller batches are culled on the calling thread
+    static constexpr size_t PARALLEL_GRAIN = 16384;
+
+    // writes 1/0 per object into visible and returns the visible count
+    // ------------------------------------------------------------------------
+    static size_t cull(const Frustum &frustum, const BoundsArrays &bounds, size_t count, uint8_t *visible)
+    {
+        std::atomic<size_t> total(0);
+        JobSystem::instance().parallelFor(count, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+            total += cullRange(frustum, bounds, begin, end, visible);
+        });
+        return total;
+    }
+
+    static size_t cullRange(const Frustum &frustum, const BoundsArrays &bounds, size_t begin, size_t end, uint8_t *visible)
+    {
+#ifdef CULLING_X86
+        static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        if (avx2)
+            return cullAVX2(frustum, bounds, begin, end, visible);
+        return cullSSE(frustum, bounds, begin, end, visible);
+#else
+        return cullScalar(frustum, bounds, begin, end, visible);
+#endif
+    }
+
+    static size_t cullScalar(const Frustum &frustum, const BoundsArrays &b, size_t begin, size_t end, uint8_t *visible)
+    {
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            bool inside = true;
+            for (const glm::vec4 &p : frustum.planes)
+            {
+                float sphere = p.x * b.sphereX[i] + p.y * b.sphereY[i] + p.z * b.sphereZ[i] + p.w + b.sphereRadius[i];
+                float box = p.x * (p.x > 0.0f ? b.maxX[i] : b.minX[i]) + p.y * (p.y > 0.0f ? b.maxY[i] : b.minY[i]) + p.z * (p.z > 0.0f ? b.maxZ[i] : b.minZ[i]) + p.w;
+                if (sphere < 0.0f || box < 0.0f)
+                {
+                    inside = false;
+                    break;
+                }
+            }
+            visible[i] = inside;
+            count += inside;
+        }
+        return count;
+    }
+
+#ifdef CULLING_X86
+    static size_t cullSSE(const Frustum &frustum, const BoundsArrays &b, size_t begin, size_t end, uint8_t *visible)
+    {
+        size_t count = 0;
+        size_t i = begin;
+        const __m128 zero = _mm_setzero_ps();
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(b.sphereX + i), cy = _mm_loadu_ps(b.sphereY + i), cz = _mm_loadu_ps(b.sphereZ + i);
+            __m128 r = _mm_loadu_ps(b.sphereRadius + i);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (const glm::vec4 &p : frustum.planes)
+            {
+                __m128 nx = _mm_set1_ps(p.x), ny = _mm_set1_ps(p.y), nz = _mm_set1_ps(p.z), w = _mm_set1_ps(p.w);
+                __m128 sphere = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_add_ps(w, r)));
+                __m128 px = _mm_loadu_ps((p.x > 0.0f ? b.maxX : b.minX) + i);
+                __m128 py = _mm_loadu_ps((p.y > 0.0f ? b.maxY : b.minY) + i);
+                __m128 pz = _mm_loadu_ps((p.z > 0.0f ? b.maxZ : b.minZ) + i);
+                __m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_add_ps(_mm_mul_ps(nz, pz), w));
+                inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(sphere, zero), _mm_cmpge_ps(box, zero)));
+            }
+            count += writeMask(_mm_movemask_ps(inside), 4, visible + i);
+        }
+        return count + cullScalar(frustum, b, i, end, visible);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static size_t cullAVX2(const Frustum &frustum, const BoundsArrays &b, size_t begin, size_t end, uint8_t *visible)
+    {
+        size_t count = 0;
+        size_t i = begin;
+        const __m256 zero = _mm256_setzero_ps();
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(b.sphereX + i), cy = _mm256_loadu_ps(b.sphereY + i), cz = _mm256_loadu_ps(b.sphereZ + i);
+            __m256 r = _mm256_loadu_ps(b.sphereRadius + i);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (const glm::vec4 &p : frustum.planes)
+            {
+                __m256 nx = _mm256_set1_ps(p.x), ny = _mm256_set1_ps(p.y), nz = _mm256_set1_ps(p.z), w = _mm256_set1_ps(p.w);
+                __m256 sphere = _mm256_fmadd_ps(nx, cx, _mm256_fmadd_ps(ny, cy, _mm256_fmadd_ps(nz, cz, _mm256_add_ps(w, r))));
+                __m256 px = _mm256_loadu_ps((p.x > 0.0f ? b.maxX : b.minX) + i);
+                __m256 py = _mm256_loadu_ps((p.y > 0.0f ? b.maxY : b.minY) + i);
+                __m256 pz = _mm256_loadu_ps((p.z > 0.0f ? b.maxZ : b.minZ) + i);
+                __m256 box = _mm256_fmadd_ps(nx, px, _mm256_fmadd_ps(ny, py, _mm256_fmadd_ps(nz, pz, w)));
+                inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(sphere, zero, _CMP_GE_OQ), _mm256_cmp_ps(box, zero, _CMP_GE_OQ)));
+            }
+            count += writeMask(_mm256_movemask_ps(inside), 8, visible + i);
+        }
+        return count + cullScalar(frustum, b, i, end, visible);
+    }
+#endif
+
+private:
+    static size_t writeMask(int mask, int lanes, uint8_t *out)
+    {
+        for (int j = 0; j < lanes; ++j)
+            out[j] = (mask >> j) & 1;
+        return (size_t)__builtin_popcount(mask);
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,244 @@
+#ifndef FRAME_BENCH_H
+#define FRAME_BENCH_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Frame timings of a benchmark run. The first warmup frames are rendered but
+// not kept; each measured frame gets the CPU time between beginFrame() and
+// endFrame(), the GPU time of the same commands from a timer query and its
+// draw calls. A query is read back QUERY_RING frames after it was issued,
+// when the GPU has normally finished it, so measuring does not stall the
+// pipeline.
+class FrameBench
+{
+public:
+    struct Sample
+    {
+        double cpuMilliseconds = 0.0;
+        double gpuMilliseconds = 0.0;
+        unsigned int draws = 0;
+    };
+
+    struct Summary
+    {
+        double min = 0.0, mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0;
+    };
+
+    // name and value of a setting the results were measured with
+    typedef std::vector<std::pair<std::string, std::string>> Settings;
+
+    static const unsigned int QUERY_RING = 4;
+
+    FrameBench(unsigned int warmup, unsigned int measured) : warmup(warmup), samples(measured)
+    {
+        glGenQueries(QUERY_RING, queries);
+    }
+
+    ~FrameBench()
+    {
+        glDeleteQueries(QUERY_RING, queries);
+    }
+
+    FrameBench(const FrameBench &) = delete;
+    FrameBench &operator=(const FrameBench &) = delete;
+
+    unsigned int frameCount() const
+    {
+        return warmup + (unsigned int)samples.size();
+    }
+
+    void beginFrame()
+    {
+        if (measuring())
+        {
+            unsigned int slot = (frame - warmup) % QUERY_RING;
+            if (frame - warmup >= QUERY_RING)
+                readQuery(frame - warmup - QUERY_RING);
+            glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+        }
+        start = std::chrono::steady_clock::now();
+    }
+
+    void endFrame(unsigned int draws)
+    {
+        if (measuring())
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            Sample &sample = samples[frame - warmup];
+            sample.cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            sample.draws = draws;
+        }
+        ++frame;
+    }
+
+    // read the queries still in flight; call once after the last frame
+    void finish()
+    {
+        unsigned int measured = frame > warmup ? frame - warmup : 0;
+        for (unsigned int i = measured > QUERY_RING ? measured - QUERY_RING : 0; i < measured; ++i)
+            readQuery(i);
+        samples.resize(measured);
+    }
+
+    const std::vector<Sample> &results() const
+    {
+        return samples;
+    }
+
+    Summary cpuSummary() const
+    {
+        return summarize([](const Sample &sample) { return sample.cpuMilliseconds; });
+    }
+
+    Summary gpuSummary() const
+    {
+        return summarize([](const Sample &sample) { return sample.gpuMilliseconds; });
+    }
+
+    Summary drawSummary() const
+    {
+        return summarize([](const Sample &sample) { return (double)sample.draws; });
+    }
+
+    // per-frame results as CSV, with the settings and summary as # comments,
+    // or, for a .json path, one object with all three
+    bool write(const std::string &path, const Settings &settings) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::FRAME_BENCH:: Failed to create " << path << std::endl;
+            return false;
+        }
+        Summary cpu = cpuSummary(), gpu = gpuSummary();
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json)
+        {
+            file << "{\n  \"settings\": {";
+            for (size_t i = 0; i < settings.size(); ++i)
+                file << (i ? ", " : "") << "\"" << escape(settings[i].first) << "\": \"" << escape(settings[i].second) << "\"";
+            file << "},\n  \"summary\": {\n";
+            file << "    \"cpu_ms\": " << toJSON(cpu) << ",\n";
+            file << "    \"gpu_ms\": " << toJSON(gpu) << ",\n";
+            file << "    \"draws\": " << toJSON(drawSummary()) << "\n  },\n";
+            file << "  \"frames\": [";
+            for (size_t i = 0; i < samples.size(); ++i)
+                file << (i ? ",\n    " : "\n    ") << "{\"cpu_ms\": " << samples[i].cpuMilliseconds << ", \"gpu_ms\": "
+                     << samples[i].gpuMilliseconds << ", \"draws\": " << samples[i].draws << "}";
+            file << "\n  ]\n}\n";
+        }
+        else
+        {
+            for (const auto &setting : settings)
+                file << "# " << setting.first << ": " << setting.second << "\n";
+            file << "# cpu_ms " << toText(cpu) << "\n# gpu_ms " << toText(gpu) << "\n# draws " << toText(drawSummary()) << "\n";
+            file << "frame,cpu_ms,gpu_ms,draws\n";
+            for (size_t i = 0; i < samples.size(); ++i)
+                file << i << "," << samples[i].cpuMilliseconds << "," << samples[i].gpuMilliseconds << "," << samples[i].draws << "\n";
+        }
+        return (bool)file;
+    }
+
+    // the settings and the CPU and GPU summaries of a CSV write() wrote
+    static bool readSummary(const std::string &path, Settings &settings, Summary &cpu, Summary &gpu)
+    {
+        std::ifstream file(path);
+        std::string line;
+        int summaries = 0;
+        while (std::getline(file, line) && line.compare(0, 2, "# ") == 0)
+        {
+            Summary *summary = line.compare(0, 9, "# cpu_ms ") == 0 ? &cpu : line.compare(0, 9, "# gpu_ms ") == 0 ? &gpu : NULL;
+            size_t colon = line.find(": ");
+            if (summary)
+                summaries += std::sscanf(line.c_str() + 9, "min %lf, mean %lf, p50 %lf, p95 %lf, p99 %lf", &summary->min, &summary->mean,
+                                         &summary->p50, &summary->p95, &summary->p99) == 5;
+            else if (colon != std::string::npos && line.compare(0, 8, "# draws ") != 0)
+                settings.push_back(std::make_pair(line.substr(2, colon - 2), line.substr(colon + 2)));
+        }
+        return summaries == 2;
+    }
+
+    static std::string toText(const Summary &summary)
+    {
+        return "min " + std::to_string(summary.min) + ", mean " + std::to_string(summary.mean) + ", p50 " + std::to_string(summary.p50) +
+               ", p95 " + std::to_string(summary.p95) + ", p99 " + std::to_string(summary.p99);
+    }
+
+private:
+    unsigned int warmup;
+    std::vector<Sample> samples;
+    unsigned int frame = 0;
+    GLuint queries[QUERY_RING];
+    std::chrono::steady_clock::time_point start;
+
+    bool measuring() const
+    {
+        return frame >= warmup && frame - warmup < samples.size();
+    }
+
+    // waits for the query of measured frame i if the GPU is not done with it
+    void readQuery(unsigned int i)
+    {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[i % QUERY_RING], GL_QUERY_RESULT, &nanoseconds);
+        samples[i].gpuMilliseconds = nanoseconds / 1.0e6;
+    }
+
+    // minimum, mean and nearest-rank percentiles of one value of the results
+    template <typename Value>
+    Summary summarize(Value value) const
+    {
+        Summary summary;
+        if (samples.empty())
+            return summary;
+        std::vector<double> values;
+        values.reserve(samples.size());
+        for (const Sample &sample : samples)
+            values.push_back(value(sample));
+        std::sort(values.begin(), values.end());
+        summary.min = values.front();
+        for (double v : values)
+            summary.mean += v;
+        summary.mean /= values.size();
+        summary.p50 = percentile(values, 0.50);
+        summary.p95 = percentile(values, 0.95);
+        summary.p99 = percentile(values, 0.99);
+        return summary;
+    }
+
+    static double percentile(const std::vector<double> &sorted, double p)
+    {
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    static std::string toJSON(const Summary &summary)
+    {
+        return "{\"min\": " + std::to_string(summary.min) + ", \"mean\": " + std::to_string(summary.mean) + ", \"p50\": " +
+               std::to_string(summary.p50) + ", \"p95\": " + std::to_string(summary.p95) + ", \"p99\": " + std::to_string(summary.p99) + "}";
+    }
+
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if ((unsigned char)c >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+};
+#endif
\ No newline at end of file
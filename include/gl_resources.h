@@ -0,0 +1,322 @@
+#ifndef GL_RESOURCES_H
+#define GL_RESOURCES_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include "gl_state.h"
+
+// Creation and editing of buffers, vertex arrays, textures, renderbuffers and
+// framebuffers by name through GL 4.5 direct state access, so setting up or
+// regenerating a resource mid-frame leaves every binding alone. Storage is
+// immutable: a resize creates a new object instead of respecifying the old
+// one. Without 4.5 the same calls bind-to-edit, through GLState where the
+// binding is one it tracks.
+
+// glCreate*, glNamed* and glTexture* entry points are core since OpenGL 4.5
+inline bool directStateAccessSupported()
+{
+    return GLAD_GL_VERSION_4_5;
+}
+
+// buffers
+// ------------------------------------------------------------------------
+// immutable storage of bytes, filled from data when given; only a dynamic
+// buffer accepts updateBuffer
+inline GLuint createBuffer(size_t bytes, const void *data, bool dynamic)
+{
+    // zero-sized storage is an error, so an empty buffer holds one unused byte
+    if (bytes == 0)
+    {
+        bytes = 1;
+        data = NULL;
+    }
+    GLuint buffer = 0;
+    if (directStateAccessSupported())
+    {
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, bytes, data, dynamic ? GL_DYNAMIC_STORAGE_BIT : 0);
+        return buffer;
+    }
+    // the copy targets belong to no vertex array or pass
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    return buffer;
+}
+
+// storage the GPU writes, e.g. by glReadPixels, and the CPU maps to read
+inline GLuint createMappableBuffer(size_t bytes)
+{
+    GLuint buffer = 0;
+    if (directStateAccessSupported())
+    {
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, bytes, NULL, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+        return buffer;
+    }
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STREAM_READ);
+    return buffer;
+}
+
+// the first bytes of a mappable buffer, until unmapBuffer; NULL on failure
+inline const void *mapBufferForReading(GLuint buffer, size_t bytes)
+{
+    if (directStateAccessSupported())
+        return glMapNamedBufferRange(buffer, 0, bytes, GL_MAP_READ_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    return glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+}
+
+inline void unmapBuffer(GLuint buffer)
+{
+    if (directStateAccessSupported())
+    {
+        glUnmapNamedBuffer(buffer);
+        return;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+}
+
+// replace the buffer with new storage; the old contents are not kept
+inline void reallocateBuffer(GLuint &buffer, size_t bytes, const void *data, bool dynamic)
+{
+    glDeleteBuffers(1, &buffer);
+    buffer = createBuffer(bytes, data, dynamic);
+}
+
+inline void updateBuffer(GLuint buffer, size_t offset, size_t bytes, const void *data)
+{
+    if (bytes == 0)
+        return;
+    if (directStateAccessSupported())
+    {
+        glNamedBufferSubData(buffer, offset, bytes, data);
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+}
+
+// copy bytes between buffers, or between disjoint ranges of one buffer
+inline void copyBuffer(GLuint source, size_t sourceOffset, GLuint target, size_t targetOffset, size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    if (directStateAccessSupported())
+    {
+        glCopyNamedBufferSubData(source, target, sourceOffset, targetOffset, bytes);
+        return;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, source);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, targetOffset, bytes);
+}
+
+// vertex arrays
+// ------------------------------------------------------------------------
+inline GLuint createVertexArray()
+{
+    GLuint vertexArray = 0;
+    if (directStateAccessSupported())
+        glCreateVertexArrays(1, &vertexArray);
+    else
+        glGenVertexArrays(1, &vertexArray);
+    return vertexArray;
+}
+
+// attribute index reads size components of type, stride bytes apart from
+// offset in buffer; integer types stay integers, divisor 1 advances per
+// instance. Each attribute gets the vertex buffer binding of its own index
+inline void setVertexAttribute(GLuint vertexArray, GLuint index, GLuint buffer, GLint size, GLenum type, GLsizei stride, size_t offset, GLuint divisor = 0)
+{
+    bool integer = type == GL_INT || type == GL_UNSIGNED_INT;
+    if (directStateAccessSupported())
+    {
+        glVertexArrayVertexBuffer(vertexArray, index, buffer, (GLintptr)offset, stride);
+        if (integer)
+            glVertexArrayAttribIFormat(vertexArray, index, size, type, 0);
+        else
+            glVertexArrayAttribFormat(vertexArray, index, size, type, GL_FALSE, 0);
+        glVertexArrayAttribBinding(vertexArray, index, index);
+        glVertexArrayBindingDivisor(vertexArray, index, divisor);
+        glEnableVertexArrayAttrib(vertexArray, index);
+        return;
+    }
+    GLState::instance().bindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (integer)
+        glVertexAttribIPointer(index, size, type, stride, (void *)offset);
+    else
+        glVertexAttribPointer(index, size, type, GL_FALSE, stride, (void *)offset);
+    glVertexAttribDivisor(index, divisor);
+    glEnableVertexAttribArray(index);
+}
+
+inline void setElementBuffer(GLuint vertexArray, GLuint buffer)
+{
+    if (directStateAccessSupported())
+    {
+        glVertexArrayElementBuffer(vertexArray, buffer);
+        return;
+    }
+    // the element binding is vertex array state
+    GLState::instance().bindVertexArray(vertexArray);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+// textures and renderbuffers
+// ------------------------------------------------------------------------
+// pixel transfer format of a sized internal format, for the fallback's
+// glTexImage2D calls
+inline void textureTransferFormat(GLenum internalFormat, GLenum &format, GLenum &type)
+{
+    switch (internalFormat)
+    {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32F:
+        format = GL_DEPTH_COMPONENT, type = GL_FLOAT;
+        break;
+    case GL_R16F:
+        format = GL_RED, type = GL_HALF_FLOAT;
+        break;
+    case GL_R32F:
+        format = GL_RED, type = GL_FLOAT;
+        break;
+    case GL_RGBA16F:
+        format = GL_RGBA, type = GL_HALF_FLOAT;
+        break;
+    case GL_RGBA32F:
+        format = GL_RGBA, type = GL_FLOAT;
+        break;
+    default:
+        format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+        break;
+    }
+}
+
+// 2D texture with levels mip levels of a sized internal format and nearest
+// filtering; contents are undefined until rendered or written
+inline GLuint createTexture2D(GLenum internalFormat, int width, int height, int levels = 1)
+{
+    GLuint texture = 0;
+    GLenum minFilter = levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+    if (directStateAccessSupported())
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+        glTextureStorage2D(texture, levels, internalFormat, width, height);
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
+    glGenTextures(1, &texture);
+    GLState::instance().bindTexture(GL_TEXTURE_2D, texture);
+    GLenum format, type;
+    textureTransferFormat(internalFormat, format, type);
+    for (int level = 0; level < levels; ++level)
+    {
+        int w = width >> level > 1 ? width >> level : 1;
+        int h = height >> level > 1 ? height >> level : 1;
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, format, type, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return texture;
+}
+
+// wrap mode of both axes, with the border color used by GL_CLAMP_TO_BORDER
+inline void setTextureWrap(GLuint texture, GLenum wrap, const GLfloat *borderColor = NULL)
+{
+    if (directStateAccessSupported())
+    {
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, wrap);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, wrap);
+        if (borderColor)
+            glTextureParameterfv(texture, GL_TEXTURE_BORDER_COLOR, borderColor);
+        return;
+    }
+    GLState::instance().bindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    if (borderColor)
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+}
+
+inline GLuint createRenderbuffer(GLenum internalFormat, int width, int height)
+{
+    GLuint renderbuffer = 0;
+    if (directStateAccessSupported())
+    {
+        glCreateRenderbuffers(1, &renderbuffer);
+        glNamedRenderbufferStorage(renderbuffer, internalFormat, width, height);
+        return renderbuffer;
+    }
+    glGenRenderbuffers(1, &renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, internalFormat, width, height);
+    return renderbuffer;
+}
+
+// framebuffers
+// ------------------------------------------------------------------------
+inline GLuint createFramebuffer()
+{
+    GLuint framebuffer = 0;
+    if (directStateAccessSupported())
+        glCreateFramebuffers(1, &framebuffer);
+    else
+        glGenFramebuffers(1, &framebuffer);
+    return framebuffer;
+}
+
+inline void attachTexture(GLuint framebuffer, GLenum attachment, GLuint texture)
+{
+    if (directStateAccessSupported())
+    {
+        glNamedFramebufferTexture(framebuffer, attachment, texture, 0);
+        return;
+    }
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+}
+
+inline void attachRenderbuffer(GLuint framebuffer, GLenum attachment, GLuint renderbuffer)
+{
+    if (directStateAccessSupported())
+    {
+        glNamedFramebufferRenderbuffer(framebuffer, attachment, GL_RENDERBUFFER, renderbuffer);
+        return;
+    }
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, renderbuffer);
+}
+
+// color attachments written, GL_NONE for a depth-only target; reads follow
+// the first one
+inline void setDrawBuffers(GLuint framebuffer, GLsizei count, const GLenum *buffers)
+{
+    if (directStateAccessSupported())
+    {
+        glNamedFramebufferDrawBuffers(framebuffer, count, buffers);
+        glNamedFramebufferReadBuffer(framebuffer, buffers[0]);
+        return;
+    }
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffers(count, buffers);
+    glReadBuffer(buffers[0]);
+}
+
+inline bool framebufferComplete(GLuint framebuffer)
+{
+    if (directStateAccessSupported())
+        return glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+#endif
\ No newline at end of file
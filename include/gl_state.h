@@ -0,0 +1,202 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <iostream>
+
+// Shadow copy of the bindings the renderer changes most often: program,
+// program pipeline, vertex array, draw/read framebuffers, the active texture
+// unit and the 2D texture of each unit. A call that would set what is
+// already bound is dropped. Every binding of these kinds must go through
+// here, and objects must be deleted through here, or the copy goes stale;
+// call invalidate() after code that binds behind its back. With validation
+// on, each call first compares the copy against the context and reports and
+// repairs any difference.
+class GLState
+{
+public:
+    // 2D texture units whose bindings are tracked; higher units pass through
+    static constexpr int TEXTURE_UNITS = 16;
+
+    // state-changing calls made and dropped since the last takeStats()
+    struct Stats
+    {
+        size_t issued = 0;
+        size_t skipped = 0;
+    };
+
+    // the state of the one GL context
+    static GLState &instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    bool validation = false;
+
+    void useProgram(GLuint program)
+    {
+        check(GL_CURRENT_PROGRAM, this->program, "program");
+        if (set(this->program, program))
+            glUseProgram(program);
+    }
+
+    void bindProgramPipeline(GLuint pipeline)
+    {
+        check(GL_PROGRAM_PIPELINE_BINDING, this->pipeline, "program pipeline");
+        if (set(this->pipeline, pipeline))
+            glBindProgramPipeline(pipeline);
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        check(GL_VERTEX_ARRAY_BINDING, this->vertexArray, "vertex array");
+        if (set(this->vertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // GL_FRAMEBUFFER sets both targets and is skipped only when both match
+    void bindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        check(GL_DRAW_FRAMEBUFFER_BINDING, drawFramebuffer, "draw framebuffer");
+        check(GL_READ_FRAMEBUFFER_BINDING, readFramebuffer, "read framebuffer");
+        bool draw = target != GL_READ_FRAMEBUFFER, read = target != GL_DRAW_FRAMEBUFFER;
+        if ((!draw || drawFramebuffer == framebuffer) && (!read || readFramebuffer == framebuffer))
+        {
+            ++stats.skipped;
+            return;
+        }
+        if (draw)
+            drawFramebuffer = framebuffer;
+        if (read)
+            readFramebuffer = framebuffer;
+        ++stats.issued;
+        glBindFramebuffer(target, framebuffer);
+    }
+
+    // unit is GL_TEXTURE0 + i
+    void activeTexture(GLenum unit)
+    {
+        check(GL_ACTIVE_TEXTURE, activeUnit, "active texture");
+        if (set(activeUnit, unit))
+            glActiveTexture(unit);
+    }
+
+    // only GL_TEXTURE_2D on the tracked units is cached
+    void bindTexture(GLenum target, GLuint texture)
+    {
+        int unit = (int)(activeUnit - GL_TEXTURE0);
+        if (target != GL_TEXTURE_2D || unit < 0 || unit >= TEXTURE_UNITS)
+        {
+            ++stats.issued;
+            glBindTexture(target, texture);
+            return;
+        }
+        check(GL_TEXTURE_BINDING_2D, textures[unit], "2D texture");
+        if (set(textures[unit], texture))
+            glBindTexture(target, texture);
+    }
+
+    // bind a 2D texture to a unit, leaving that unit active
+    void bindTextureUnit(int unit, GLuint texture)
+    {
+        activeTexture(GL_TEXTURE0 + unit);
+        bindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    // deleting a bound object rebinds 0, so the copy must forget it too
+    // ------------------------------------------------------------------------
+    void deleteTextures(GLsizei count, const GLuint *ids)
+    {
+        for (GLsizei i = 0; i < count; ++i)
+        {
+            for (GLuint &texture : textures)
+                forget(texture, ids[i]);
+        }
+        glDeleteTextures(count, ids);
+    }
+
+    void deleteVertexArrays(GLsizei count, const GLuint *ids)
+    {
+        for (GLsizei i = 0; i < count; ++i)
+            forget(vertexArray, ids[i]);
+        glDeleteVertexArrays(count, ids);
+    }
+
+    void deleteFramebuffers(GLsizei count, const GLuint *ids)
+    {
+        for (GLsizei i = 0; i < count; ++i)
+        {
+            forget(drawFramebuffer, ids[i]);
+            forget(readFramebuffer, ids[i]);
+        }
+        glDeleteFramebuffers(count, ids);
+    }
+
+    // mark every binding unknown, so the next call of each kind is issued
+    void invalidate()
+    {
+        program = pipeline = vertexArray = UNKNOWN;
+        drawFramebuffer = readFramebuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (GLuint &texture : textures)
+            texture = UNKNOWN;
+    }
+
+    // counts since the previous call, e.g. once per frame
+    Stats takeStats()
+    {
+        Stats taken = stats;
+        stats = Stats();
+        return taken;
+    }
+
+private:
+    static constexpr GLuint UNKNOWN = 0xffffffffu;
+
+    GLuint program, pipeline, vertexArray;
+    GLuint drawFramebuffer, readFramebuffer;
+    GLenum activeUnit;
+    GLuint textures[TEXTURE_UNITS];
+    Stats stats;
+
+    GLState()
+    {
+        invalidate();
+    }
+
+    bool set(GLuint &cached, GLuint value)
+    {
+        if (cached == value)
+        {
+            ++stats.skipped;
+            return false;
+        }
+        cached = value;
+        ++stats.issued;
+        return true;
+    }
+
+    static void forget(GLuint &cached, GLuint id)
+    {
+        if (cached == id)
+            cached = 0;
+    }
+
+    // compare a known cached binding with the context; a mismatch means some
+    // call bypassed the cache, so report it and trust the context from now on
+    void check(GLenum binding, GLuint &cached, const char *name)
+    {
+        if (!validation || cached == UNKNOWN)
+            return;
+        GLint actual = 0;
+        glGetIntegerv(binding, &actual);
+        if ((GLuint)actual == cached)
+            return;
+        std::cout << "ERROR::GL_STATE:: cached " << name << " " << cached << " but " << actual << " is bound" << std::endl;
+        cached = (GLuint)actual;
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,393 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gl_state.h"
+#include "gl_resources.h"
+#include "shader.h"
+#include "scene.h"
+#include "culling.h"
+
+// command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// GPU-driven culling and submission. Every mesh is packed into one vertex and
+// one index buffer and the per-entity matrices, bounds and flags are uploaded
+// to storage buffers as they are laid out in the scene. A compute pass (cull.cs)
+// tests each entity against the frustum of every view and appends the visible
+// ones to per-view, per-mesh instance lists; a second pass (compact.cs) packs
+// the non-empty draws of each view together. Every pass is then one multi-draw
+// whatever the entity count. Needs OpenGL 4.3; with 4.6 the draw count is read
+// straight from the GPU, before that it is read back once per frame.
+//
+// View 0 can also be occlusion culled in two phases: entities hidden behind
+// the max-depth pyramid (hiz.cs) of the previous frame are held back, the rest
+// drawn, the pyramid rebuilt from that depth and the held back entities tested
+// again; the ones now in view go to lateView().
+class GpuCulling
+{
+public:
+    // matches MAX_VIEWS in cull.cs and compact.cs, one is kept for the late view
+    static constexpr int MAX_VIEWS = 8;
+    // matches local_size_x in cull.cs and compact.cs
+    static constexpr GLuint WORKGROUP_SIZE = 64;
+    // matches local_size_x/y in hiz.cs
+    static constexpr GLuint PYRAMID_GROUP_SIZE = 8;
+    // texture unit the pyramid is bound to while culling
+    static constexpr int PYRAMID_UNIT = 8;
+
+    // a view draws the entities inside its frustum that carry any of the mask's
+    // flags and none of the exclude flags
+    struct View
+    {
+        glm::mat4 viewProjection;
+        uint32_t mask;
+        uint32_t exclude;
+    };
+
+    // compute shaders, storage buffers and multi-draw indirect are core since 4.3
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_4_3;
+    }
+
+    GpuCulling() : cullStage(GL_COMPUTE_SHADER, "cull.cs"), compactStage(GL_COMPUTE_SHADER, "compact.cs"),
+                   pyramidStage(GL_COMPUTE_SHADER, "hiz.cs"),
+                   cullShader(cullStage), compactShader(compactStage), pyramidShader(pyramidStage)
+    {
+        // the buffers are created at their first reserve; the VAO is
+        // repointed whenever a buffer it reads is recreated
+        VAO = createVertexArray();
+    }
+
+    ~GpuCulling()
+    {
+        GLState::instance().deleteVertexArrays(1, &VAO);
+        GLuint buffers[] = { vertexBuffer, indexBuffer, worldBuffer, normalBuffer, boundsBuffer,
+                             entityBuffer, materialBuffer, commandBuffer, instanceBuffer, compactedBuffer };
+        glDeleteBuffers(10, buffers);
+        GLState::instance().deleteTextures(1, &pyramid);
+    }
+
+    GpuCulling(const GpuCulling &) = delete;
+    GpuCulling &operator=(const GpuCulling &) = delete;
+
+    // multi-draw calls draw() issued, for the caller to read and reset
+    size_t drawCalls = 0;
+
+    // copy this frame's entities to the GPU; meshes are repacked when one of
+    // them was regenerated or added
+    // ------------------------------------------------------------------------
+    void upload(const Scene &scene)
+    {
+        packMeshes(scene);
+        entityCount = scene.size();
+        const size_t n = entityCount;
+
+        reserve(worldBuffer, worldCapacity, n * sizeof(glm::mat4));
+        reserve(normalBuffer, normalCapacity, n * sizeof(glm::mat4));
+        reserve(boundsBuffer, boundsCapacity, 10 * n * sizeof(float));
+        reserve(entityBuffer, entityCapacity, 3 * n * sizeof(uint32_t));
+        subData(worldBuffer, 0, scene.transforms.world.data(), n * sizeof(glm::mat4));
+        subData(normalBuffer, 0, scene.transforms.normal.data(), n * sizeof(glm::mat4));
+        BoundsArrays b = scene.boundsArrays();
+        const float *arrays[] = { b.sphereX, b.sphereY, b.sphereZ, b.sphereRadius, b.minX, b.minY, b.minZ, b.maxX, b.maxY, b.maxZ };
+        for (int a = 0; a < 10; ++a)
+            subData(boundsBuffer, a * n * sizeof(float), arrays[a], n * sizeof(float));
+        subData(entityBuffer, 0, scene.mesh.data(), n * sizeof(uint32_t));
+        subData(entityBuffer, n * sizeof(uint32_t), scene.material.data(), n * sizeof(uint32_t));
+        subData(entityBuffer, 2 * n * sizeof(uint32_t), scene.flags.data(), n * sizeof(uint32_t));
+
+        std::vector<glm::vec4> materials;
+        materials.reserve(3 * scene.materials.size());
+        for (const Material &m : scene.materials)
+        {
+            materials.push_back(glm::vec4(m.ambient, m.alpha));
+            materials.push_back(glm::vec4(m.diffuse, 0.0f));
+            materials.push_back(glm::vec4(m.specular, 0.0f));
+        }
+        reserve(materialBuffer, materialCapacity, materials.size() * sizeof(glm::vec4));
+        subData(materialBuffer, 0, materials.data(), materials.size() * sizeof(glm::vec4));
+
+        // each mesh's instance range starts after the entities of the meshes before it
+        meshFirstEntity.assign(meshDraws.size() + 1, 0);
+        for (size_t i = 0; i < n; ++i)
+            ++meshFirstEntity[scene.mesh[i] + 1];
+        for (size_t m = 1; m < meshFirstEntity.size(); ++m)
+            meshFirstEntity[m] += meshFirstEntity[m - 1];
+    }
+
+    // first phase: cull the uploaded entities against each view, and view 0
+    // against the previous frame's depth pyramid when occlusion is on
+    // ------------------------------------------------------------------------
+    void cull(const View *views, int count, bool occlusion)
+    {
+        viewCount = count < MAX_VIEWS - 1 ? count : MAX_VIEWS - 1;
+        occlusionCulling = occlusion;
+        if (!occlusion)
+            pyramidValid = false;
+        const GLuint meshCount = (GLuint)meshDraws.size();
+
+        // fresh commands with no instances, each view and the late view owning entityCount instance slots
+        std::vector<DrawElementsIndirectCommand> commands((viewCount + 1) * meshCount);
+        for (int v = 0; v <= viewCount; ++v)
+        {
+            for (GLuint m = 0; m < meshCount; ++m)
+            {
+                DrawElementsIndirectCommand &command = commands[v * meshCount + m];
+                command = meshDraws[m];
+                command.baseInstance = (GLuint)(v * entityCount + meshFirstEntity[m]);
+            }
+        }
+        reserve(commandBuffer, commandCapacity, commands.size() * sizeof(DrawElementsIndirectCommand));
+        subData(commandBuffer, 0, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+        // the rejected list follows the instance ranges and starts with its count
+        rejectedBase = (viewCount + 1) * entityCount;
+        // entity index, one per instance starting at the draw's baseInstance
+        if (reserve(instanceBuffer, instanceCapacity, (rejectedBase + 1 + entityCount) * sizeof(GLuint)))
+            setVertexAttribute(VAO, 2, instanceBuffer, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0, 1);
+        GLuint zero[MAX_VIEWS] = {};
+        subData(instanceBuffer, rejectedBase * sizeof(GLuint), zero, sizeof(GLuint));
+        reserve(compactedBuffer, compactedCapacity, MAX_VIEWS * sizeof(GLuint) + commands.size() * sizeof(DrawElementsIndirectCommand));
+        subData(compactedBuffer, 0, zero, sizeof(zero));
+        bindStorage();
+
+        cullShader.use();
+        setCullUniforms(0, occlusion && pyramidValid);
+        cullShader.setInt("viewCount", viewCount);
+        for (int v = 0; v < viewCount; ++v)
+        {
+            Frustum frustum = Frustum::fromMatrix(views[v].viewProjection);
+            for (int p = 0; p < 6; ++p)
+                cullShader.setVec4("planes[" + std::to_string(v * 6 + p) + "]", frustum.planes[p]);
+            cullShader.setUint("viewMasks[" + std::to_string(v) + "]", views[v].mask);
+            cullShader.setUint("viewExcludes[" + std::to_string(v) + "]", views[v].exclude);
+        }
+        glDispatchCompute(groups(entityCount), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        compact(0, viewCount + 1);
+        cameraViewProjection = views[0].viewProjection;
+    }
+
+    // second phase, once view 0 is drawn: rebuild the pyramid from its depth
+    // and fill lateView() with the held back entities it no longer hides
+    // ------------------------------------------------------------------------
+    void cullOccluded(GLuint depthTexture, int width, int height)
+    {
+        if (!occlusionCulling)
+            return;
+        bool rejected = pyramidValid;
+        buildPyramid(depthTexture, width, height);
+        if (!rejected)
+            return;
+
+        bindStorage();
+        cullShader.use();
+        setCullUniforms(1, true);
+        glDispatchCompute(groups(entityCount), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        compact(viewCount, 1);
+    }
+
+    // entities of view 0 that only passed the second phase
+    int lateView() const
+    {
+        return viewCount;
+    }
+
+    // draw what view survived culling with the shader, which reads the entity
+    // index from attribute 2 and the per-entity data from the storage buffers
+    // ------------------------------------------------------------------------
+    void draw(Shader &shader, int view)
+    {
+        if (view > viewCount || meshDraws.empty())
+            return;
+        shader.use();
+        shader.setUint("entityCount", (GLuint)entityCount);
+        bindStorage();
+        GLState::instance().bindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, compactedBuffer);
+        const GLsizei meshCount = (GLsizei)meshDraws.size();
+        const void *commands = (const void *)(MAX_VIEWS * sizeof(GLuint) + view * meshCount * sizeof(DrawElementsIndirectCommand));
+        if (GLAD_GL_VERSION_4_6)
+        {
+            glBindBuffer(GL_PARAMETER_BUFFER, compactedBuffer);
+            glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, commands, view * sizeof(GLuint), meshCount, 0);
+            ++drawCalls;
+        }
+        else if (drawCounts[view] > 0)
+        {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, drawCounts[view], 0);
+            ++drawCalls;
+        }
+    }
+
+private:
+    ShaderStage cullStage, compactStage, pyramidStage;
+    Shader cullShader, compactShader, pyramidShader;
+
+    GLuint VAO = 0;
+    GLuint vertexBuffer = 0, indexBuffer = 0;
+    GLuint worldBuffer = 0, normalBuffer = 0, boundsBuffer = 0, entityBuffer = 0, materialBuffer = 0;
+    GLuint commandBuffer = 0, instanceBuffer = 0, compactedBuffer = 0;
+    size_t worldCapacity = 0, normalCapacity = 0, boundsCapacity = 0, entityCapacity = 0, materialCapacity = 0;
+    size_t commandCapacity = 0, instanceCapacity = 0, compactedCapacity = 0;
+
+    // one template command per mesh: its index range in the packed buffers
+    std::vector<DrawElementsIndirectCommand> meshDraws;
+    // segment counts the packed meshes were built with
+    std::vector<int> packedSegments;
+    std::vector<size_t> meshFirstEntity;
+    size_t entityCount = 0;
+    size_t rejectedBase = 0;
+    int viewCount = 0;
+    GLuint drawCounts[MAX_VIEWS] = {};
+
+    // max-depth pyramid of view 0, R32F with a full mip chain
+    GLuint pyramid = 0;
+    int pyramidWidth = 0, pyramidHeight = 0, pyramidLevels = 0;
+    bool pyramidValid = false;
+    bool occlusionCulling = false;
+    // view 0 of this frame, and of the depth the pyramid holds
+    glm::mat4 cameraViewProjection, pyramidViewProjection;
+
+    void setCullUniforms(int phase, bool occlusion)
+    {
+        cullShader.setUint("entityCount", (GLuint)entityCount);
+        cullShader.setUint("meshCount", (GLuint)meshDraws.size());
+        cullShader.setInt("phase", phase);
+        cullShader.setBool("occlusion", occlusion);
+        cullShader.setUint("lateView", (GLuint)viewCount);
+        cullShader.setUint("rejectedBase", (GLuint)rejectedBase);
+        cullShader.setInt("depthPyramid", PYRAMID_UNIT);
+        cullShader.setMat4("pyramidViewProjection", pyramidViewProjection);
+        GLState::instance().bindTextureUnit(PYRAMID_UNIT, pyramid);
+    }
+
+    // pack the non-empty commands of views [first, first + count)
+    void compact(int first, int count)
+    {
+        const GLuint meshCount = (GLuint)meshDraws.size();
+        compactShader.use();
+        compactShader.setUint("meshCount", meshCount);
+        compactShader.setInt("firstView", first);
+        compactShader.setInt("viewCount", count);
+        glDispatchCompute(groups(count * meshCount), 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // without indirect counts the counts come back to the CPU (this waits for the culling)
+        if (!GLAD_GL_VERSION_4_6)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, compactedBuffer);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, first * sizeof(GLuint), count * sizeof(GLuint), drawCounts + first);
+        }
+    }
+
+    // level 0 copies the depth texture, every further level keeps the
+    // farthest depth of the texels below it
+    void buildPyramid(GLuint depthTexture, int width, int height)
+    {
+        if (width != pyramidWidth || height != pyramidHeight)
+        {
+            GLState::instance().deleteTextures(1, &pyramid);
+            pyramidWidth = width;
+            pyramidHeight = height;
+            pyramidLevels = 1;
+            for (int size = width > height ? width : height; size > 1; size /= 2)
+                ++pyramidLevels;
+            pyramid = createTexture2D(GL_R32F, width, height, pyramidLevels);
+            setTextureWrap(pyramid, GL_CLAMP_TO_EDGE);
+        }
+
+        pyramidShader.use();
+        pyramidShader.setInt("source", PYRAMID_UNIT);
+        GLState &state = GLState::instance();
+        state.activeTexture(GL_TEXTURE0 + PYRAMID_UNIT);
+        for (int level = 0; level < pyramidLevels; ++level)
+        {
+            int w = width >> level > 1 ? width >> level : 1;
+            int h = height >> level > 1 ? height >> level : 1;
+            state.bindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid);
+            pyramidShader.setBool("copy", level == 0);
+            pyramidShader.setInt("sourceLevel", level - 1);
+            glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((w + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (h + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+        pyramidValid = true;
+        pyramidViewProjection = cameraViewProjection;
+    }
+
+    void packMeshes(const Scene &scene)
+    {
+        bool current = packedSegments.size() == scene.meshes.size();
+        for (size_t m = 0; current && m < scene.meshes.size(); ++m)
+            current = packedSegments[m] == scene.meshes[m].builtSegments;
+        if (current)
+            return;
+
+        std::vector<float> vertices;
+        std::vector<int> indices;
+        meshDraws.clear();
+        packedSegments.clear();
+        for (const Mesh &mesh : scene.meshes)
+        {
+            DrawElementsIndirectCommand draw = { (GLuint)mesh.indices.size(), 0, (GLuint)indices.size(), (GLint)(vertices.size() / 6), 0 };
+            meshDraws.push_back(draw);
+            packedSegments.push_back(mesh.builtSegments);
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        }
+        reallocateBuffer(vertexBuffer, vertices.size() * sizeof(float), vertices.data(), false);
+        reallocateBuffer(indexBuffer, indices.size() * sizeof(int), indices.data(), false);
+        setElementBuffer(VAO, indexBuffer);
+        // position attribute
+        setVertexAttribute(VAO, 0, vertexBuffer, 3, GL_FLOAT, 6 * sizeof(float), 0);
+        // normal attribute
+        setVertexAttribute(VAO, 1, vertexBuffer, 3, GL_FLOAT, 6 * sizeof(float), 3 * sizeof(float));
+    }
+
+    // storage bindings, matching the binding points in the shaders
+    void bindStorage()
+    {
+        GLuint buffers[] = { worldBuffer, normalBuffer, boundsBuffer, entityBuffer, materialBuffer,
+                             commandBuffer, instanceBuffer, compactedBuffer };
+        for (GLuint b = 0; b < 8; ++b)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+    }
+
+    // make the buffer hold at least bytes, doubling to amortize growth;
+    // returns whether it was recreated, dropping its contents
+    static bool reserve(GLuint &buffer, size_t &capacity, size_t bytes)
+    {
+        if (bytes <= capacity && capacity > 0)
+            return false;
+        capacity = capacity * 2 > bytes ? capacity * 2 : (bytes > 0 ? bytes : 64);
+        reallocateBuffer(buffer, capacity, NULL, true);
+        return true;
+    }
+
+    static void subData(GLuint buffer, size_t offset, const void *data, size_t bytes)
+    {
+        updateBuffer(buffer, offset, bytes, data);
+    }
+
+    static GLuint groups(size_t items)
+    {
+        return (GLuint)((items + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE);
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+#include <iostream>
+
+// An OpenGL 3.3 core context without a window or display server, for
+// rendering into framebuffer objects on machines with no X server or GPU.
+// The display comes from Mesa's surfaceless platform when available, the
+// default EGL display otherwise, and the context is made current with no
+// surface at all (EGL_KHR_surfaceless_context), so Mesa's llvmpipe software
+// rasterizer is enough. Only built with HEADLESS defined ('make HEADLESS=1'),
+// as it links libEGL.
+class HeadlessContext
+{
+public:
+    HeadlessContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT)
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (getPlatformDisplay && clientExtensions && std::strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            std::cout << "Failed to initialize an EGL display" << std::endl;
+            display = EGL_NO_DISPLAY;
+            return;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cout << "EGL display has no desktop OpenGL" << std::endl;
+            return;
+        }
+
+        const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "Failed to find an EGL config for OpenGL" << std::endl;
+            return;
+        }
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT)
+        {
+            std::cout << "Failed to create an OpenGL 3.3 core context through EGL" << std::endl;
+            return;
+        }
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            std::cout << "Failed to make the EGL context current without a surface" << std::endl;
+            eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+        }
+    }
+
+    ~HeadlessContext()
+    {
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+    }
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    // whether the context is current on this thread
+    bool valid() const
+    {
+        return context != EGL_NO_CONTEXT;
+    }
+
+    // GL entry points, for gladLoadGLLoader
+    static void *procAddress(const char *name)
+    {
+        return (void *)eglGetProcAddress(name);
+    }
+
+private:
+    EGLDisplay display;
+    EGLContext context;
+};
+#endif
+#endif
\ No newline at end of file
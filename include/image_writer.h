@@ -0,0 +1,491 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Image encoders for bottom-up RGBA8 frames as glReadPixels returns them;
+// each appends a complete top-down file to out.
+// ----------------------------------------------------------------------------
+enum ImageFormat
+{
+    IMAGE_PPM,      // binary RGB, no alpha
+    IMAGE_QOI,      // "Quite OK Image" format: lossless, cheap to encode
+    IMAGE_PNG,      // RGBA in stored (uncompressed) deflate blocks
+    IMAGE_EXR       // OpenEXR scanlines of half floats, uncompressed
+};
+
+// format named by the file extension, PPM when there is none it knows
+inline ImageFormat imageFormat(const std::string &path)
+{
+    size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    for (char &c : extension)
+        c = (char)std::tolower((unsigned char)c);
+    if (extension == "qoi")
+        return IMAGE_QOI;
+    if (extension == "png")
+        return IMAGE_PNG;
+    if (extension == "exr")
+        return IMAGE_EXR;
+    return IMAGE_PPM;
+}
+
+inline void appendBigEndian32(std::vector<unsigned char> &out, uint32_t value)
+{
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+inline void appendLittleEndian(std::vector<unsigned char> &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        out.push_back((unsigned char)(value >> (8 * i)));
+}
+
+inline void encodePPM(int width, int height, const unsigned char *rgba, std::vector<unsigned char> &out)
+{
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    size_t start = out.size();
+    out.resize(start + header.size() + (size_t)width * height * 3);
+    std::memcpy(&out[start], header.data(), header.size());
+    unsigned char *pixel = &out[start + header.size()];
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const unsigned char *source = &rgba[(size_t)y * width * 4];
+        for (int x = 0; x < width; ++x, pixel += 3)
+        {
+            pixel[0] = source[x * 4 + 0];
+            pixel[1] = source[x * 4 + 1];
+            pixel[2] = source[x * 4 + 2];
+        }
+    }
+}
+
+// see qoiformat.org: every pixel becomes a run, a reference into a table of
+// recently seen colors, a small difference to the previous pixel, or a
+// literal
+inline void encodeQOI(int width, int height, const unsigned char *rgba, std::vector<unsigned char> &out)
+{
+    out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+    appendBigEndian32(out, (uint32_t)width);
+    appendBigEndian32(out, (uint32_t)height);
+    out.push_back(4);   // channels
+    out.push_back(0);   // sRGB with linear alpha
+
+    unsigned char seen[64][4] = {};
+    unsigned char previous[4] = { 0, 0, 0, 255 };
+    int run = 0;
+    size_t remaining = (size_t)width * height;
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const unsigned char *pixel = &rgba[(size_t)y * width * 4];
+        for (int x = 0; x < width; ++x, pixel += 4)
+        {
+            --remaining;
+            if (std::memcmp(pixel, previous, 4) == 0)
+            {
+                if (++run == 62 || remaining == 0)
+                {
+                    out.push_back((unsigned char)(0xc0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                out.push_back((unsigned char)(0xc0 | (run - 1)));
+                run = 0;
+            }
+
+            int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+            if (std::memcmp(seen[hash], pixel, 4) == 0)
+                out.push_back((unsigned char)hash);
+            else
+            {
+                std::memcpy(seen[hash], pixel, 4);
+                if (pixel[3] == previous[3])
+                {
+                    int dr = (signed char)(pixel[0] - previous[0]);
+                    int dg = (signed char)(pixel[1] - previous[1]);
+                    int db = (signed char)(pixel[2] - previous[2]);
+                    int drg = dr - dg, dbg = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                        out.push_back((unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                    {
+                        out.push_back((unsigned char)(0x80 | (dg + 32)));
+                        out.push_back((unsigned char)((drg + 8) << 4 | (dbg + 8)));
+                    }
+                    else
+                        out.insert(out.end(), { 0xfe, pixel[0], pixel[1], pixel[2] });
+                }
+                else
+                    out.insert(out.end(), { 0xff, pixel[0], pixel[1], pixel[2], pixel[3] });
+            }
+            std::memcpy(previous, pixel, 4);
+        }
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+}
+
+inline uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0)
+{
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Deflate compression would cost more than the rest of the frame; stored
+// blocks keep the file a valid PNG at raw size, and QOI is the compact
+// choice.
+inline void encodePNG(int width, int height, const unsigned char *rgba, std::vector<unsigned char> &out)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.insert(out.end(), signature, signature + 8);
+
+    // chunk: length, type, data, CRC of type and data
+    auto chunk = [&out](const char *type, const std::vector<unsigned char> &data) {
+        appendBigEndian32(out, (uint32_t)data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        appendBigEndian32(out, crc32(&out[start], out.size() - start));
+    };
+
+    std::vector<unsigned char> header;
+    appendBigEndian32(header, (uint32_t)width);
+    appendBigEndian32(header, (uint32_t)height);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 });     // 8-bit RGBA, no interlace
+    chunk("IHDR", header);
+
+    // zlib stream: each row behind filter type 0, cut into stored blocks of
+    // at most 65535 bytes, then the Adler-32 of the rows
+    size_t rowBytes = (size_t)width * 4 + 1;
+    size_t rawBytes = rowBytes * height;
+    std::vector<unsigned char> raw(rawBytes);
+    for (int y = 0; y < height; ++y)
+    {
+        raw[y * rowBytes] = 0;
+        std::memcpy(&raw[y * rowBytes + 1], &rgba[(size_t)(height - 1 - y) * width * 4], rowBytes - 1);
+    }
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < rawBytes; )
+    {
+        // 5552 bytes keep b below 2^32 before the modulo
+        size_t end = i + 5552 < rawBytes ? i + 5552 : rawBytes;
+        for (; i < end; ++i)
+        {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    std::vector<unsigned char> stream = { 0x78, 0x01 };
+    stream.reserve(2 + rawBytes + (rawBytes / 65535 + 1) * 5 + 4);
+    size_t offset = 0;
+    do
+    {
+        size_t size = rawBytes - offset < 65535 ? rawBytes - offset : 65535;
+        stream.push_back(offset + size == rawBytes ? 1 : 0);
+        appendLittleEndian(stream, size, 2);
+        appendLittleEndian(stream, ~size & 0xffff, 2);
+        stream.insert(stream.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while (offset < rawBytes);
+    appendBigEndian32(stream, b << 16 | a);
+    chunk("IDAT", stream);
+    chunk("IEND", std::vector<unsigned char>());
+}
+
+// half float of a value in [0, 1], which never needs the subnormal range
+// for multiples of 1/255
+inline uint16_t halfOfUnit(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, 4);
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    if (exponent <= 0)
+        return 0;
+    uint32_t mantissa = bits & 0x7fffff;
+    uint32_t half = (uint32_t)exponent << 10 | mantissa >> 13;
+    // round to nearest; a carry into the exponent is still the right value
+    if (mantissa & 0x1000)
+        ++half;
+    return (uint16_t)half;
+}
+
+// the 8-bit values scaled to [0, 1]; the scene is lit and blended in linear
+// space and stored without a transfer curve, so no decoding is needed
+inline void encodeEXR(int width, int height, const unsigned char *rgba, std::vector<unsigned char> &out)
+{
+    static const std::vector<uint16_t> halves = [] {
+        std::vector<uint16_t> h(256);
+        for (int v = 0; v < 256; ++v)
+            h[v] = halfOfUnit(v / 255.0f);
+        return h;
+    }();
+
+    out.insert(out.end(), { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 });
+    auto attribute = [&out](const char *name, const char *type, const std::vector<unsigned char> &value) {
+        out.insert(out.end(), name, name + std::strlen(name) + 1);
+        out.insert(out.end(), type, type + std::strlen(type) + 1);
+        appendLittleEndian(out, value.size(), 4);
+        out.insert(out.end(), value.begin(), value.end());
+    };
+    auto bytes = [](std::initializer_list<uint64_t> values, int size) {
+        std::vector<unsigned char> v;
+        for (uint64_t value : values)
+            appendLittleEndian(v, value, size);
+        return v;
+    };
+
+    // channels sorted by name, as the format requires: half, linear, unsampled
+    std::vector<unsigned char> channels;
+    for (char name : { 'A', 'B', 'G', 'R' })
+    {
+        channels.insert(channels.end(), { (unsigned char)name, 0 });
+        appendLittleEndian(channels, 1, 4);     // HALF
+        appendLittleEndian(channels, 0, 4);     // pLinear and reserved
+        appendLittleEndian(channels, 1, 4);     // x sampling
+        appendLittleEndian(channels, 1, 4);     // y sampling
+    }
+    channels.push_back(0);
+    attribute("channels", "chlist", channels);
+    attribute("compression", "compression", std::vector<unsigned char>(1, 0));
+    attribute("dataWindow", "box2i", bytes({ 0, 0, (uint64_t)width - 1, (uint64_t)height - 1 }, 4));
+    attribute("displayWindow", "box2i", bytes({ 0, 0, (uint64_t)width - 1, (uint64_t)height - 1 }, 4));
+    attribute("lineOrder", "lineOrder", std::vector<unsigned char>(1, 0));
+    attribute("pixelAspectRatio", "float", bytes({ 0x3f800000 }, 4));
+    attribute("screenWindowCenter", "v2f", bytes({ 0, 0 }, 4));
+    attribute("screenWindowWidth", "float", bytes({ 0x3f800000 }, 4));
+    out.push_back(0);
+
+    // offset table, then per scanline its y, its size and each channel's row
+    size_t lineBytes = (size_t)width * 4 * 2;
+    size_t table = out.size();
+    size_t firstLine = table + (size_t)height * 8;
+    for (int y = 0; y < height; ++y)
+        appendLittleEndian(out, firstLine + (size_t)y * (8 + lineBytes), 8);
+    out.resize(firstLine + (size_t)height * (8 + lineBytes));
+    unsigned char *line = &out[firstLine];
+    for (int y = 0; y < height; ++y, line += 8 + lineBytes)
+    {
+        uint32_t header[2] = { (uint32_t)y, (uint32_t)lineBytes };
+        for (int i = 0; i < 8; ++i)
+            line[i] = (unsigned char)(header[i / 4] >> (8 * (i % 4)));
+        const unsigned char *source = &rgba[(size_t)(height - 1 - y) * width * 4];
+        for (int c = 0; c < 4; ++c)
+        {
+            // A, B, G, R from RGBA
+            int component = 3 - c;
+            unsigned char *target = line + 8 + (size_t)c * width * 2;
+            for (int x = 0; x < width; ++x)
+            {
+                uint16_t half = halves[source[x * 4 + component]];
+                target[x * 2] = (unsigned char)half;
+                target[x * 2 + 1] = (unsigned char)(half >> 8);
+            }
+        }
+    }
+}
+
+inline void encodeImage(ImageFormat format, int width, int height, const unsigned char *rgba, std::vector<unsigned char> &out)
+{
+    if (format == IMAGE_QOI)
+        encodeQOI(width, height, rgba, out);
+    else if (format == IMAGE_PNG)
+        encodePNG(width, height, rgba, out);
+    else if (format == IMAGE_EXR)
+        encodeEXR(width, height, rgba, out);
+    else
+        encodePPM(width, height, rgba, out);
+}
+
+// one unbuffered write of the whole file, so the bytes are not copied again
+// on their way to the kernel
+inline bool writeFile(const std::string &path, const std::vector<unsigned char> &data)
+{
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    std::setvbuf(file, NULL, _IONBF, 0);
+    bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    return std::fclose(file) == 0 && written;
+}
+
+// encode and write on the calling thread, in the format of path's extension
+inline bool writeImage(const std::string &path, int width, int height, const unsigned char *rgba)
+{
+    std::vector<unsigned char> data;
+    encodeImage(imageFormat(path), width, height, rgba, data);
+    return writeFile(path, data);
+}
+
+// Encodes and writes frames on a pool of worker threads, so the render
+// thread only copies each frame into a free staging buffer. There are
+// queueCapacity buffers; when every one holds a frame not yet written,
+// write() waits for a worker to finish one, which keeps memory bounded when
+// the disk or the encoder falls behind, and the stats count those waits.
+class ImageWriter
+{
+public:
+    struct Stats
+    {
+        uint64_t queued = 0;
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        uint64_t bytes = 0;
+        // writes that found no free buffer, and how long they waited in total
+        uint64_t blocked = 0;
+        double blockedMilliseconds = 0.0;
+    };
+
+    // workers 0 picks one per hardware thread beyond the render thread
+    explicit ImageWriter(unsigned int workers = 0, size_t queueCapacity = 8)
+    {
+        if (workers == 0)
+            workers = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1;
+        buffers.resize(queueCapacity > workers ? queueCapacity : workers);
+        for (size_t b = 0; b < buffers.size(); ++b)
+            freeBuffers.push_back(b);
+        for (unsigned int i = 0; i < workers; ++i)
+            threads.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ImageWriter()
+    {
+        finish();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        work.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    // queue a bottom-up RGBA8 frame for path, in the format of its
+    // extension; the pixels are copied before this returns
+    // ------------------------------------------------------------------------
+    void write(const std::string &path, int width, int height, const unsigned char *rgba)
+    {
+        size_t b;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (freeBuffers.empty())
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                room.wait(lock, [this] { return !freeBuffers.empty(); });
+                ++stats.blocked;
+                stats.blockedMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+            b = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+        buffers[b].assign(rgba, rgba + (size_t)width * height * 4);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back({ path, width, height, b });
+            ++stats.queued;
+        }
+        work.notify_one();
+    }
+
+    // wait until every queued frame is on disk
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this] { return freeBuffers.size() == buffers.size(); });
+    }
+
+    Stats statistics()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Task
+    {
+        std::string path;
+        int width, height;
+        size_t buffer;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<unsigned char>> buffers;
+    std::vector<size_t> freeBuffers;
+    std::deque<Task> tasks;
+    std::mutex mutex;
+    // work: a task was queued; room: a buffer came back
+    std::condition_variable work, room;
+    Stats stats;
+    bool quit = false;
+
+    void workerLoop()
+    {
+        // encoded file, reused across frames
+        std::vector<unsigned char> data;
+        for (;;)
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work.wait(lock, [this] { return quit || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            data.clear();
+            encodeImage(imageFormat(task.path), task.width, task.height, buffers[task.buffer].data(), data);
+            bool written = writeFile(task.path, data);
+            if (!written)
+                std::cout << "ERROR::IMAGE_WRITER:: Failed to write " << task.path << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeBuffers.push_back(task.buffer);
+                if (written)
+                {
+                    ++stats.written;
+                    stats.bytes += data.size();
+                }
+                else
+                    ++stats.failed;
+            }
+            room.notify_all();
+        }
+    }
+};
+#endif
\ No newline at end of file
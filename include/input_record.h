@@ -0,0 +1,213 @@
+#ifndef INPUT_RECORD_H
+#define INPUT_RECORD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// One input event and the simulation time it happened at, in seconds.
+// START and END mark the first and the last frame of a recorded run.
+struct InputEvent
+{
+    enum Type : uint8_t
+    {
+        START,
+        MOVE,       // a: mask of the movement keys held from now on
+        KEY,        // a, b, c: key, action, mods
+        CURSOR,     // x, y: cursor position
+        SCROLL,     // y: scroll offset
+        BUTTON,     // a, b, c: mouse button, action, mods
+        END
+    };
+
+    uint8_t type = START;
+    float time = 0.0f;
+    int32_t a = 0, b = 0, c = 0;
+    float x = 0.0f, y = 0.0f;
+};
+
+// The file is "LMIR", a version, then per event its type byte, its time as
+// a float and only the fields the type uses, so a minute of mouse look is a
+// few tens of kilobytes. Values are stored in host byte order.
+const char INPUT_RECORD_MAGIC[4] = { 'L', 'M', 'I', 'R' };
+const uint32_t INPUT_RECORD_VERSION = 1;
+
+// Writes the events of a run as they happen.
+class InputRecorder
+{
+public:
+    explicit InputRecorder(const std::string &path) : file(path, std::ios::binary)
+    {
+        if (!file)
+        {
+            std::cout << "ERROR::INPUT_RECORD:: Failed to create " << path << std::endl;
+            return;
+        }
+        file.write(INPUT_RECORD_MAGIC, 4);
+        write(INPUT_RECORD_VERSION);
+    }
+
+    bool valid() const
+    {
+        return (bool)file;
+    }
+
+    void record(const InputEvent &event)
+    {
+        write(event.type);
+        write(event.time);
+        switch (event.type)
+        {
+        case InputEvent::MOVE:
+            write((uint8_t)event.a);
+            break;
+        case InputEvent::KEY:
+            write((int16_t)event.a);
+            write((uint8_t)event.b);
+            write((uint8_t)event.c);
+            break;
+        case InputEvent::CURSOR:
+            write(event.x);
+            write(event.y);
+            break;
+        case InputEvent::SCROLL:
+            write(event.y);
+            break;
+        case InputEvent::BUTTON:
+            write((uint8_t)event.a);
+            write((uint8_t)event.b);
+            write((uint8_t)event.c);
+            break;
+        default:
+            break;
+        }
+    }
+
+private:
+    std::ofstream file;
+
+    template <typename T>
+    void write(T value)
+    {
+        file.write((const char *)&value, sizeof(T));
+    }
+};
+
+// Reads a recording back and hands out its events in time order. Replayed
+// at a fixed timestep, frame n is simulated at startTime() + n * timestep
+// whatever the recording's frame times were, and gets the events up to that
+// time; every replay of a file renders the same frames, on any build.
+class InputReplay
+{
+public:
+    explicit InputReplay(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        uint32_t version = 0;
+        if (data.size() >= 8)
+            std::memcpy(&version, &data[4], 4);
+        if (data.size() < 8 || std::memcmp(data.data(), INPUT_RECORD_MAGIC, 4) != 0 || version != INPUT_RECORD_VERSION)
+        {
+            std::cout << "ERROR::INPUT_RECORD:: " << path << " is not an input recording" << std::endl;
+            return;
+        }
+
+        size_t offset = 8;
+        bool complete = true;
+        while (offset < data.size() && complete)
+        {
+            InputEvent event;
+            complete = read(data, offset, event.type) && read(data, offset, event.time);
+            switch (event.type)
+            {
+            case InputEvent::MOVE:
+            {
+                uint8_t mask = 0;
+                complete = complete && read(data, offset, mask);
+                event.a = mask;
+                break;
+            }
+            case InputEvent::KEY:
+            case InputEvent::BUTTON:
+            {
+                int16_t key = 0;
+                uint8_t button = 0, action = 0, mods = 0;
+                if (event.type == InputEvent::KEY)
+                    complete = complete && read(data, offset, key);
+                else
+                    complete = complete && read(data, offset, button);
+                complete = complete && read(data, offset, action) && read(data, offset, mods);
+                event.a = event.type == InputEvent::KEY ? key : button;
+                event.b = action;
+                event.c = mods;
+                break;
+            }
+            case InputEvent::CURSOR:
+                complete = complete && read(data, offset, event.x) && read(data, offset, event.y);
+                break;
+            case InputEvent::SCROLL:
+                complete = complete && read(data, offset, event.y);
+                break;
+            default:
+                break;
+            }
+            if (complete)
+                events.push_back(event);
+        }
+        // a run that ended without its END event is replayed up to its last event
+        if (events.empty() || events.back().type != InputEvent::END)
+        {
+            std::cout << "ERROR::INPUT_RECORD:: " << path << " is truncated, replaying what it has" << std::endl;
+            InputEvent end;
+            end.type = InputEvent::END;
+            end.time = events.empty() ? 0.0f : events.back().time;
+            events.push_back(end);
+        }
+    }
+
+    bool valid() const
+    {
+        return !events.empty();
+    }
+
+    float startTime() const
+    {
+        return events.front().type == InputEvent::START ? events.front().time : 0.0f;
+    }
+
+    // frames a replay at timestep takes to reach the end of the recording;
+    // the slack keeps rounding in the times from adding a frame
+    unsigned int frameCount(float timestep) const
+    {
+        return (unsigned int)std::ceil((events.back().time - startTime()) / timestep - 1.0e-3f) + 1;
+    }
+
+    // the next event at or before time, if any is left
+    bool next(float time, InputEvent &event)
+    {
+        if (cursor >= events.size() || events[cursor].time > time)
+            return false;
+        event = events[cursor++];
+        return true;
+    }
+
+private:
+    std::vector<InputEvent> events;
+    size_t cursor = 0;
+
+    template <typename T>
+    static bool read(const std::vector<char> &data, size_t &offset, T &value)
+    {
+        if (offset + sizeof(T) > data.size())
+            return false;
+        std::memcpy(&value, &data[offset], sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+};
+#endif
\ No newline at end of file
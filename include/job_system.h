@@ -0,0 +1,121 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small persistent worker pool for data-parallel loops over large object
+// arrays. The calling thread takes part in every loop, so a pool without
+// extra hardware threads degrades to a plain serial loop.
+class JobSystem
+{
+public:
+    // the shared pool, one worker per additional hardware thread
+    static JobSystem &instance()
+    {
+        static JobSystem pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+        return pool;
+    }
+
+    explicit JobSystem(unsigned int workerCount) : generation(0), busyWorkers(0), quit(false)
+    {
+        for (unsigned int i = 0; i < workerCount; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    unsigned int threadCount() const
+    {
+        return (unsigned int)workers.size() + 1;
+    }
+
+    // call body(begin, end) over [0, count) in chunks of grain items; runs
+    // serially when the range is a single chunk or there are no workers
+    // ------------------------------------------------------------------------
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &body)
+    {
+        if (grain == 0)
+            grain = 1;
+        if (workers.empty() || count <= grain)
+        {
+            if (count > 0)
+                body(0, count);
+            return;
+        }
+        std::lock_guard<std::mutex> serialize(submitMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &body;
+            jobCount = count;
+            jobGrain = grain;
+            nextItem = 0;
+            busyWorkers = (unsigned int)workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        runChunks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex, submitMutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t, size_t)> *job = nullptr;
+    size_t jobCount = 0, jobGrain = 1;
+    std::atomic<size_t> nextItem{0};
+    unsigned long long generation;
+    unsigned int busyWorkers;
+    bool quit;
+
+    void runChunks()
+    {
+        for (;;)
+        {
+            size_t begin = nextItem.fetch_add(jobGrain);
+            if (begin >= jobCount)
+                return;
+            size_t end = begin + jobGrain < jobCount ? begin + jobGrain : jobCount;
+            (*job)(begin, end);
+        }
+    }
+
+    void workerLoop()
+    {
+        unsigned long long seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit)
+                    return;
+                seen = generation;
+            }
+            runChunks();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busyWorkers;
+            }
+            done.notify_one();
+        }
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+// without the min/max macros and the rest of the API, which would break
+// std::min, std::max and names like near and far in the files including this
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// A binary PPM the size of the final image, mapped into memory so tiles can
+// be stored at their place as they come in. The pages are backed by the
+// file rather than the heap, and flush() starts writing finished rows out,
+// so a 32K image does not have to fit in memory at once.
+class MappedImage
+{
+public:
+    MappedImage(const std::string &path, int width, int height) : width(width), height(height)
+    {
+        std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        headerBytes = header.size();
+        size = headerBytes + (size_t)width * height * 3;
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file != INVALID_HANDLE_VALUE)
+            mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+        if (mapping)
+            data = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+#else
+        file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (file >= 0 && ftruncate(file, (off_t)size) == 0)
+        {
+            void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            if (mapped != MAP_FAILED)
+                data = (unsigned char *)mapped;
+        }
+#endif
+        if (!data)
+        {
+            std::cout << "ERROR::MAPPED_IMAGE:: Failed to map " << size << " bytes of " << path << std::endl;
+            return;
+        }
+        std::memcpy(data, header.data(), headerBytes);
+    }
+
+    ~MappedImage()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (data)
+            munmap(data, size);
+        if (file >= 0)
+            close(file);
+#endif
+    }
+
+    MappedImage(const MappedImage &) = delete;
+    MappedImage &operator=(const MappedImage &) = delete;
+
+    bool valid() const
+    {
+        return data != NULL;
+    }
+
+    // RGB pixels of row y, counted from the top
+    unsigned char *row(int y)
+    {
+        return data + headerBytes + (size_t)y * width * 3;
+    }
+
+    // start writing rows [first, first + count) back to the file without
+    // waiting for it
+    void flush(int first, int count)
+    {
+        size_t begin = (size_t)(row(first) - data);
+        size_t end = (size_t)(row(first + count) - data);
+#ifdef _WIN32
+        FlushViewOfFile(data + begin, end - begin);
+#else
+        // msync wants a page-aligned start
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        begin -= begin % page;
+        msync(data + begin, end - begin, MS_ASYNC);
+#endif
+    }
+
+private:
+    int width, height;
+    size_t headerBytes = 0;
+    size_t size = 0;
+    unsigned char *data = NULL;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+};
+#endif
\ No newline at end of file
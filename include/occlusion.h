@@ -0,0 +1,367 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "scene.h"
+
+// Software occlusion culling on the CPU. The simplified meshes of the
+// occluder entities are rasterized into a small depth buffer stored in 8x8
+// tiles, four pixels at a time with SSE, and every entity still in view is
+// then tested against it: it is hidden when the nearest corner of its box lies
+// behind every depth stored under its screen rectangle. The work runs on a
+// dedicated thread between begin() and finish(), next to the draw submission
+// that does not need the result (the shadow passes), and needs no GPU readback.
+class SoftwareOcclusion
+{
+public:
+    static constexpr int TILE_SIZE = 8;
+
+    SoftwareOcclusion(int width, int height)
+        : width((width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE), height((height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+          tilesX(this->width / TILE_SIZE), tilesY(this->height / TILE_SIZE),
+          depth(this->width * this->height), tileMax(tilesX * tilesY),
+          pending(false), quit(false)
+    {
+        worker = std::thread([this] { workerLoop(); });
+    }
+
+    ~SoftwareOcclusion()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    SoftwareOcclusion(const SoftwareOcclusion &) = delete;
+    SoftwareOcclusion &operator=(const SoftwareOcclusion &) = delete;
+
+    // start culling on the worker thread; visible holds the frustum results
+    // of the view and is cleared for occluded entities. The scene must not
+    // change until finish()
+    // ------------------------------------------------------------------------
+    void begin(const Scene &frameScene, const glm::mat4 &frameViewProjection, int frameView, uint8_t *frameVisible)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            scene = &frameScene;
+            viewProjection = frameViewProjection;
+            view = frameView;
+            visible = frameVisible;
+            pending = true;
+        }
+        wake.notify_all();
+    }
+
+    // wait for the worker and return how many entities it hid
+    size_t finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return !pending; });
+        return occludedCount;
+    }
+
+    // rasterize every occluder and test every visible entity on the calling thread
+    // ------------------------------------------------------------------------
+    size_t run(const Scene &s, const glm::mat4 &vp, int v, uint8_t *vis)
+    {
+        clear();
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            if ((s.flags[i] & SCENE_OCCLUDER) && vis[i])
+                rasterizeMesh(s.meshes[s.mesh[i]], s.transforms.getMVP(v, i));
+        }
+        updateTileMax();
+        size_t count = 0;
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            if (vis[i] && occluded(s.worldBox(i), vp))
+            {
+                vis[i] = 0;
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // true when the box is behind everything rasterized over its screen rectangle
+    // ------------------------------------------------------------------------
+    bool occluded(const AABB &box, const glm::mat4 &vp) const
+    {
+        glm::vec2 lo(1e30f), hi(-1e30f);
+        float nearest = 1.0f;
+        for (int c = 0; c < 8; ++c)
+        {
+            glm::vec3 corner((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+            glm::vec4 clip = vp * glm::vec4(corner, 1.0f);
+            // crossing the near plane: keep it
+            if (clip.w <= NEAR_W)
+                return false;
+            glm::vec3 screen = toScreen(clip);
+            lo = glm::min(lo, glm::vec2(screen));
+            hi = glm::max(hi, glm::vec2(screen));
+            nearest = glm::min(nearest, screen.z);
+        }
+        if (hi.x < 0.0f || hi.y < 0.0f || lo.x >= width || lo.y >= height)
+            return false;
+        int x0 = pixel(lo.x, width), y0 = pixel(lo.y, height);
+        int x1 = pixel(hi.x, width), y1 = pixel(hi.y, height);
+
+        for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ++ty)
+        {
+            for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; ++tx)
+            {
+                // the whole tile is nearer
+                if (tileMax[ty * tilesX + tx] < nearest)
+                    continue;
+                int px0 = glm::max(x0, tx * TILE_SIZE), px1 = glm::min(x1, tx * TILE_SIZE + TILE_SIZE - 1);
+                int py0 = glm::max(y0, ty * TILE_SIZE), py1 = glm::min(y1, ty * TILE_SIZE + TILE_SIZE - 1);
+                for (int y = py0; y <= py1; ++y)
+                {
+                    for (int x = px0; x <= px1; ++x)
+                    {
+                        if (depth[index(x, y)] >= nearest)
+                            return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        std::fill(depth.begin(), depth.end(), 1.0f);
+    }
+
+    // transform a mesh's occluder geometry and rasterize its triangles
+    void rasterizeMesh(const Mesh &mesh, const glm::mat4 &mvp)
+    {
+        const std::vector<float> &vertices = mesh.occluderVertices;
+        const std::vector<int> &indices = mesh.occluderIndices;
+        clipVertices.resize(vertices.size() / 6);
+        for (size_t v = 0; v < clipVertices.size(); ++v)
+            clipVertices[v] = mvp * glm::vec4(vertices[6 * v], vertices[6 * v + 1], vertices[6 * v + 2], 1.0f);
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            const glm::vec4 &a = clipVertices[indices[t]], &b = clipVertices[indices[t + 1]], &c = clipVertices[indices[t + 2]];
+            rasterizeClipped(a, b, c);
+        }
+    }
+
+    // rasterize the part of a clip-space triangle in front of the near plane
+    // (z >= -w); a vertex closer than the near plane would land at a depth
+    // below 0 and hide what lies behind the real triangle
+    void rasterizeClipped(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+    {
+        const glm::vec4 *corners[3] = { &a, &b, &c };
+        float distance[3];
+        int inside = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            distance[i] = corners[i]->z + corners[i]->w;
+            inside += distance[i] >= 0.0f;
+        }
+        if (inside == 3)
+        {
+            rasterizeProjected(a, b, c);
+            return;
+        }
+        if (inside == 0)
+            return;
+        // one edge crossing at a time keeps the polygon's order: 1 or 2
+        // vertices in front give a triangle or a quad
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            int j = (i + 1) % 3;
+            if (distance[i] >= 0.0f)
+                polygon[count++] = *corners[i];
+            if ((distance[i] >= 0.0f) != (distance[j] >= 0.0f))
+            {
+                float f = distance[i] / (distance[i] - distance[j]);
+                polygon[count++] = *corners[i] + f * (*corners[j] - *corners[i]);
+            }
+        }
+        for (int i = 1; i + 1 < count; ++i)
+            rasterizeProjected(polygon[0], polygon[i], polygon[i + 1]);
+    }
+
+    void rasterizeProjected(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+    {
+        // only reached by a projection without a near plane in front of the eye
+        if (a.w <= NEAR_W || b.w <= NEAR_W || c.w <= NEAR_W)
+            return;
+        rasterizeTriangle(toScreen(a), toScreen(b), toScreen(c));
+    }
+
+    // depth-only rasterization keeping the nearest depth at each pixel center;
+    // both windings are drawn since back faces occlude as well
+    // ------------------------------------------------------------------------
+    void rasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+    {
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (area < 0.0f)
+        {
+            std::swap(v1, v2);
+            area = -area;
+        }
+        if (area < 1e-6f)
+            return;
+        glm::vec3 lo = glm::min(v0, glm::min(v1, v2)), hi = glm::max(v0, glm::max(v1, v2));
+        if (hi.x < 0.0f || hi.y < 0.0f || lo.x >= width || lo.y >= height)
+            return;
+        int minX = pixel(lo.x, width), maxX = pixel(hi.x, width);
+        int minY = pixel(lo.y, height), maxY = pixel(hi.y, height);
+
+        // edge functions e = a * x + b * y + c, each positive inside and zero on
+        // the edge opposite its vertex; depth is a plane in screen space
+        Edge e0 = edge(v1, v2), e1 = edge(v2, v0), e2 = edge(v0, v1);
+        float inv = 1.0f / area;
+        float za = (e0.a * v0.z + e1.a * v1.z + e2.a * v2.z) * inv;
+        float zb = (e0.b * v0.z + e1.b * v1.z + e2.b * v2.z) * inv;
+        float zc = (e0.c * v0.z + e1.c * v1.z + e2.c * v2.z) * inv;
+
+#ifdef CULLING_X86
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        for (int y = minY; y <= maxY; ++y)
+        {
+            __m128 py = _mm_set1_ps(y + 0.5f);
+            __m128 r0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.b), py), _mm_set1_ps(e0.c));
+            __m128 r1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.b), py), _mm_set1_ps(e1.c));
+            __m128 r2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.b), py), _mm_set1_ps(e2.c));
+            __m128 rz = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zb), py), _mm_set1_ps(zc));
+            for (int x = minX & ~3; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.a), px), r0);
+                __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.a), px), r1);
+                __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.a), px), r2);
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), rz);
+                float *d = &depth[index(x, y)];
+                __m128 old = _mm_load_ps(d);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_store_ps(d, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; ++x)
+            {
+                float px = x + 0.5f;
+                if (e0.at(px, py) < 0.0f || e1.at(px, py) < 0.0f || e2.at(px, py) < 0.0f)
+                    continue;
+                float &d = depth[index(x, y)];
+                d = glm::min(d, za * px + zb * py + zc);
+            }
+        }
+#endif
+    }
+
+    // the farthest depth of each tile, for the early-out in occluded()
+    void updateTileMax()
+    {
+        for (int t = 0; t < tilesX * tilesY; ++t)
+        {
+            const float *d = &depth[t * TILE_SIZE * TILE_SIZE];
+            float m = d[0];
+            for (int p = 1; p < TILE_SIZE * TILE_SIZE; ++p)
+                m = glm::max(m, d[p]);
+            tileMax[t] = m;
+        }
+    }
+
+    float depthAt(int x, int y) const
+    {
+        return depth[index(x, y)];
+    }
+
+private:
+    // clip w below which a point counts as on or behind the near plane
+    static constexpr float NEAR_W = 1e-5f;
+
+    struct Edge
+    {
+        float a, b, c;
+        float at(float x, float y) const { return a * x + b * y + c; }
+    };
+
+    const int width, height;
+    const int tilesX, tilesY;
+    AlignedVector<float> depth;
+    std::vector<float> tileMax;
+    std::vector<glm::vec4> clipVertices;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const Scene *scene = nullptr;
+    glm::mat4 viewProjection;
+    int view = 0;
+    uint8_t *visible = nullptr;
+    size_t occludedCount = 0;
+    bool pending, quit;
+
+    static Edge edge(const glm::vec3 &from, const glm::vec3 &to)
+    {
+        return { from.y - to.y, to.x - from.x, from.x * to.y - to.x * from.y };
+    }
+
+    glm::vec3 toScreen(const glm::vec4 &clip) const
+    {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+    }
+
+    // the pixel holding screen coordinate c, clamped to the buffer
+    static int pixel(float c, int size)
+    {
+        return (int)glm::clamp(c, 0.0f, (float)(size - 1));
+    }
+
+    // pixels are stored tile by tile, rows of 8 inside a tile
+    int index(int x, int y) const
+    {
+        return ((y / TILE_SIZE) * tilesX + x / TILE_SIZE) * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return quit || pending; });
+                if (quit)
+                    return;
+            }
+            size_t count = run(*scene, viewProjection, view, visible);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                occludedCount = count;
+                pending = false;
+            }
+            done.notify_all();
+        }
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,244 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "gl_state.h"
+#include "gl_resources.h"
+
+// Frame capture without stalling the pipeline: capture() starts an
+// asynchronous glReadPixels of a framebuffer into the next of a ring of
+// pixel pack buffers and fences it, and poll() maps the buffers whose fence
+// has signalled, oldest first, handing the pixels to the consumer. A frame
+// is mapped by the first poll() after the GPU finished it, so the GPU may
+// run up to N - 1 captures ahead; only when all N buffers are still pending
+// does capture() wait for the oldest, which the stats count.
+//
+// With holdFrames set, a delivered frame stays mapped after the consumer
+// returns, so another thread can read the pixels straight from the pixel
+// buffer; it calls release(frame.index) when done, and the GL thread unmaps
+// the buffer at its next capture() or poll(). A capture into a slot still
+// held waits for the release, which the stats count as a stall as well.
+class FrameReadback
+{
+public:
+    static constexpr int DEFAULT_RING_SIZE = 3;
+
+    // a finished frame: bottom-up RGBA8 rows, valid during the callback only
+    struct Frame
+    {
+        uint64_t index;
+        // what the frame shows, as given to capture()
+        uint64_t item;
+        int width, height;
+        const unsigned char *rgba;
+    };
+    typedef std::function<void(const Frame &)> Consumer;
+
+    struct Stats
+    {
+        uint64_t captured = 0;
+        uint64_t delivered = 0;
+        // captures that had to wait for a full ring, and how long in total
+        uint64_t stalls = 0;
+        double stallMilliseconds = 0.0;
+    };
+
+    bool holdFrames = false;
+    // called instead of the consumer, with rgba NULL, for a frame whose
+    // buffer could not be mapped
+    Consumer failed;
+
+    FrameReadback(int width, int height, Consumer consumer, int ringSize = DEFAULT_RING_SIZE)
+        : width(width), height(height), consumer(consumer), slots(ringSize > 1 ? ringSize : 2)
+    {
+        for (Slot &slot : slots)
+            slot.buffer = createMappableBuffer(frameBytes());
+    }
+
+    ~FrameReadback()
+    {
+        // whoever held frames has stopped reading them by now
+        for (Slot &slot : slots)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            if (slot.held)
+                unmapBuffer(slot.buffer);
+            glDeleteBuffers(1, &slot.buffer);
+        }
+    }
+
+    FrameReadback(const FrameReadback &) = delete;
+    FrameReadback &operator=(const FrameReadback &) = delete;
+
+    // queue a read of the framebuffer's color, which must be width x height;
+    // item tells the consumer what it shows, e.g. a job or tile number
+    // ------------------------------------------------------------------------
+    void capture(GLuint framebuffer, uint64_t item = 0)
+    {
+        Slot &slot = slots[next];
+        reclaim();
+        if (slot.held)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                releasedFrame.wait(lock, [&slot] { return slot.released; });
+            }
+            reclaim();
+            ++stats.stalls;
+            stats.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (slot.fence)
+        {
+            // the ring is full and this slot holds the oldest frame
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            deliver(next, true);
+            ++stats.stalls;
+            stats.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        GLState::instance().bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        // client-memory reads must not land in the buffer
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.index = stats.captured++;
+        slot.item = item;
+        next = (next + 1) % slots.size();
+    }
+
+    // hand every finished frame to the consumer without waiting
+    void poll()
+    {
+        reclaim();
+        for (size_t s = oldest(); slots[s].fence && deliver(s, false); s = oldest())
+            ;
+    }
+
+    // wait for and deliver every pending frame
+    void flush()
+    {
+        for (size_t s = oldest(); slots[s].fence; s = oldest())
+            deliver(s, true);
+    }
+
+    // give back a held frame; any thread may call this
+    void release(uint64_t index)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Slot &slot : slots)
+            {
+                if (slot.held && slot.index == index)
+                    slot.released = true;
+            }
+        }
+        releasedFrame.notify_all();
+    }
+
+    const Stats &statistics() const
+    {
+        return stats;
+    }
+
+private:
+    struct Slot
+    {
+        GLuint buffer = 0;
+        GLsync fence = 0;
+        uint64_t index = 0;
+        uint64_t item = 0;
+        // mapped by a consumer that has not released it yet (holdFrames)
+        bool held = false;
+        bool released = false;
+    };
+
+    int width, height;
+    Consumer consumer;
+    std::vector<Slot> slots;
+    // slot the next capture uses; the pending ones follow it around the ring
+    size_t next = 0;
+    Stats stats;
+    // guards released, which other threads set
+    std::mutex mutex;
+    std::condition_variable releasedFrame;
+
+    size_t frameBytes() const
+    {
+        return (size_t)width * height * 4;
+    }
+
+    // the pending slot captured first, or next when none is pending
+    size_t oldest() const
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            size_t s = (next + i) % slots.size();
+            if (slots[s].fence)
+                return s;
+        }
+        return next;
+    }
+
+    // unmap the held frames released since the last call
+    void reclaim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Slot &slot : slots)
+        {
+            if (slot.held && slot.released)
+            {
+                unmapBuffer(slot.buffer);
+                slot.held = slot.released = false;
+            }
+        }
+    }
+
+    // map slot s and pass it on once its fence signalled; false if it has not
+    bool deliver(size_t s, bool wait)
+    {
+        Slot &slot = slots[s];
+        GLuint64 timeout = wait ? 1000000000ull : 0;
+        GLenum status;
+        do
+            status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        while (wait && status == GL_TIMEOUT_EXPIRED);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        const unsigned char *pixels = (const unsigned char *)mapBufferForReading(slot.buffer, frameBytes());
+        Frame frame = { slot.index, slot.item, width, height, pixels };
+        if (pixels)
+        {
+            if (holdFrames)
+            {
+                // before the consumer, which may hand the frame to a thread
+                // that releases it at once
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.held = true;
+            }
+            consumer(frame);
+            if (!holdFrames)
+                unmapBuffer(slot.buffer);
+        }
+        else if (failed)
+            failed(frame);
+        ++stats.delivered;
+        return true;
+    }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,474 @@
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+#ifdef HEADLESS
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A render farm on one machine: a coordinator process hands the items of a
+// batch or tiled render (job or tile numbers) to headless worker processes,
+// each with its own GL context, over a Unix domain socket, and collects the
+// pixels they render. Every message is a FarmMessage header and size bytes
+// of payload. Nothing in the framing depends on the socket type, so a TCP
+// listener would let workers on other hosts join as they are; the header is
+// sent in host byte order, which is fine between hosts of one architecture.
+struct FarmMessage
+{
+    enum Type : uint32_t
+    {
+        HELLO,      // worker: connected; item holds its process id
+        WORK,       // coordinator: render item
+        RESULT,     // worker: the item's bottom-up RGBA8 pixels
+        FAILED,     // worker: the item could not be rendered
+        QUIT        // coordinator: no work is left
+    };
+
+    uint32_t type;
+    uint32_t item;
+    uint32_t width, height;
+    uint64_t size;
+};
+
+inline bool sendAll(int socket, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+inline bool receiveAll(int socket, void *data, size_t size)
+{
+    char *bytes = (char *)data;
+    while (size > 0)
+    {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+inline bool sendMessage(int socket, const FarmMessage &message, const void *payload = NULL)
+{
+    return sendAll(socket, &message, sizeof(message)) && (message.size == 0 || sendAll(socket, payload, message.size));
+}
+
+// The worker's end: the render loop asks next() for an item to render and
+// sends back its pixels once they are read back, or a failure for an item
+// it has no job or tile for or whose pixels could not be read back.
+class FarmWorker
+{
+public:
+    explicit FarmWorker(const std::string &path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        socketId = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socketId < 0 || connect(socketId, (const sockaddr *)&address, sizeof(address)) != 0)
+        {
+            std::cout << "ERROR::FARM:: Failed to connect to " << path << std::endl;
+            if (socketId >= 0)
+                close(socketId);
+            socketId = -1;
+            return;
+        }
+        FarmMessage hello = { FarmMessage::HELLO, (uint32_t)getpid(), 0, 0, 0 };
+        sendMessage(socketId, hello);
+    }
+
+    ~FarmWorker()
+    {
+        if (socketId >= 0)
+            close(socketId);
+    }
+
+    FarmWorker(const FarmWorker &) = delete;
+    FarmWorker &operator=(const FarmWorker &) = delete;
+
+    bool valid() const
+    {
+        return socketId >= 0;
+    }
+
+    // whether an item is already waiting, so next() returns at once
+    bool ready() const
+    {
+        pollfd descriptor = { socketId, POLLIN, 0 };
+        return poll(&descriptor, 1, 0) > 0;
+    }
+
+    // wait for the next item; false once there is no more work
+    bool next(unsigned int &item)
+    {
+        FarmMessage message;
+        if (!receiveAll(socketId, &message, sizeof(message)) || message.type != FarmMessage::WORK)
+            return false;
+        item = message.item;
+        return true;
+    }
+
+    bool sendResult(unsigned int item, int width, int height, const unsigned char *rgba)
+    {
+        FarmMessage result = { FarmMessage::RESULT, item, (uint32_t)width, (uint32_t)height, (uint64_t)width * height * 4 };
+        return sendMessage(socketId, result, rgba);
+    }
+
+    bool sendFailure(unsigned int item)
+    {
+        FarmMessage failure = { FarmMessage::FAILED, item, 0, 0, 0 };
+        return sendMessage(socketId, failure);
+    }
+
+private:
+    int socketId = -1;
+};
+
+// The coordinator's end. Items start out split into one contiguous range
+// per worker, so neighbouring tiles or similar jobs share a process; a
+// worker that runs out takes from the back of the largest range left, so
+// fast workers steal from slow ones and a worker that never started loses
+// its whole range. Each worker has up to PREFETCH items sent ahead, which
+// covers its readback latency and the round trip. Items in flight on a
+// worker that dies or that reports a failure go to a retry queue served
+// first, up to MAX_ATTEMPTS renders each.
+class FarmCoordinator
+{
+public:
+    static constexpr int PREFETCH = 4;
+    static constexpr int MAX_ATTEMPTS = 3;
+    // how long workers get to exit after QUIT before they are killed
+    static constexpr int QUIT_MILLISECONDS = 5000;
+
+    // a finished item: bottom-up RGBA8 rows, valid during the callback only
+    typedef std::function<void(unsigned int item, int width, int height, const unsigned char *rgba)> Consumer;
+
+    struct Stats
+    {
+        unsigned int completed = 0;
+        unsigned int failed = 0;
+        unsigned int retried = 0;
+        unsigned int stolen = 0;
+        unsigned int workersLost = 0;
+    };
+
+    FarmCoordinator(unsigned int itemCount, Consumer consumer) : itemCount(itemCount), consumer(consumer), attempts(itemCount, 0)
+    {
+    }
+
+    // start workerCount processes of program with arguments and
+    // "--worker <socket>", render every item on them and stop them again;
+    // true if every item completed
+    // ------------------------------------------------------------------------
+    bool run(unsigned int workerCount, const std::string &program, const std::vector<std::string> &arguments)
+    {
+        std::string path = "/tmp/lighting-model-farm-" + std::to_string(getpid()) + ".sock";
+        unlink(path.c_str());
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (const sockaddr *)&address, sizeof(address)) != 0 || listen(listener, (int)workerCount) != 0)
+        {
+            std::cout << "ERROR::FARM:: Failed to listen on " << path << std::endl;
+            if (listener >= 0)
+                close(listener);
+            return false;
+        }
+
+        workers.assign(workerCount, Worker());
+        for (unsigned int w = 0; w < workerCount; ++w)
+        {
+            for (unsigned int item = itemCount * w / workerCount; item < itemCount * (w + 1) / workerCount; ++item)
+                workers[w].own.push_back(item);
+            workers[w].pid = spawn(program, arguments, path);
+            workers[w].exited = workers[w].pid < 0;
+        }
+
+        std::vector<unsigned char> pixels;
+        while (stats.completed + stats.failed < itemCount)
+        {
+            reap();
+            if (!anyAlive())
+            {
+                // no one is left to render what remains
+                stats.failed = itemCount - stats.completed;
+                std::cout << "ERROR::FARM:: All workers exited, " << stats.failed << " items not rendered" << std::endl;
+                break;
+            }
+            for (Worker &worker : workers)
+                dispatch(worker);
+
+            std::vector<pollfd> descriptors(1, pollfd{ listener, POLLIN, 0 });
+            std::vector<Worker *> polled;
+            for (Worker &worker : workers)
+            {
+                if (worker.socket >= 0)
+                {
+                    descriptors.push_back(pollfd{ worker.socket, POLLIN, 0 });
+                    polled.push_back(&worker);
+                }
+            }
+            if (poll(descriptors.data(), descriptors.size(), 100) <= 0)
+                continue;
+            if (descriptors[0].revents & POLLIN)
+                accept(listener);
+            for (size_t d = 1; d < descriptors.size(); ++d)
+            {
+                if (descriptors[d].revents)
+                    receive(*polled[d - 1], pixels);
+            }
+        }
+
+        FarmMessage quit = { FarmMessage::QUIT, 0, 0, 0, 0 };
+        for (Worker &worker : workers)
+        {
+            if (worker.socket >= 0)
+            {
+                sendMessage(worker.socket, quit);
+                close(worker.socket);
+            }
+        }
+        // a worker stuck in a frame or that never connected is killed
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(QUIT_MILLISECONDS);
+        for (Worker &worker : workers)
+        {
+            if (worker.pid <= 0 || worker.exited)
+                continue;
+            pid_t pid;
+            while ((pid = waitpid(worker.pid, NULL, WNOHANG)) == 0 && std::chrono::steady_clock::now() < deadline)
+                usleep(10000);
+            if (pid == 0)
+            {
+                kill(worker.pid, SIGKILL);
+                waitpid(worker.pid, NULL, 0);
+            }
+        }
+        close(listener);
+        unlink(path.c_str());
+        return stats.failed == 0;
+    }
+
+    const Stats &statistics() const
+    {
+        return stats;
+    }
+
+private:
+    struct Worker
+    {
+        pid_t pid = -1;
+        int socket = -1;
+        bool exited = false;
+        // items not handed out yet, in order
+        std::deque<unsigned int> own;
+        std::vector<unsigned int> inFlight;
+    };
+
+    unsigned int itemCount;
+    Consumer consumer;
+    std::vector<int> attempts;
+    std::vector<Worker> workers;
+    std::deque<unsigned int> retries;
+    Stats stats;
+
+    // the arguments are gathered before fork(): the child of a process with
+    // other threads running must not allocate, only exec or exit
+    static pid_t spawn(const std::string &program, const std::vector<std::string> &arguments, const std::string &path)
+    {
+        std::vector<char *> argv;
+        argv.push_back((char *)program.c_str());
+        for (const std::string &argument : arguments)
+            argv.push_back((char *)argument.c_str());
+        argv.push_back((char *)"--worker");
+        argv.push_back((char *)path.c_str());
+        argv.push_back(NULL);
+        pid_t pid = fork();
+        if (pid != 0)
+            return pid;
+        execv(program.c_str(), argv.data());
+        _exit(127);
+    }
+
+    bool anyAlive() const
+    {
+        for (const Worker &worker : workers)
+        {
+            if (!worker.exited || worker.socket >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    // collect exited workers; one still connected is handled when its socket closes
+    void reap()
+    {
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+        {
+            for (Worker &worker : workers)
+            {
+                if (worker.pid == pid)
+                    worker.exited = true;
+            }
+        }
+    }
+
+    void accept(int listener)
+    {
+        int connection = ::accept(listener, NULL, NULL);
+        if (connection < 0)
+            return;
+        FarmMessage hello;
+        if (receiveAll(connection, &hello, sizeof(hello)) && hello.type == FarmMessage::HELLO)
+        {
+            for (Worker &worker : workers)
+            {
+                if (worker.pid == (pid_t)hello.item && worker.socket < 0)
+                {
+                    worker.socket = connection;
+                    return;
+                }
+            }
+        }
+        close(connection);
+    }
+
+    // next item for a worker: a retry, its own next one, or the last one of
+    // the largest range left
+    bool take(Worker &worker, unsigned int &item)
+    {
+        if (!retries.empty())
+        {
+            item = retries.front();
+            retries.pop_front();
+            return true;
+        }
+        if (!worker.own.empty())
+        {
+            item = worker.own.front();
+            worker.own.pop_front();
+            return true;
+        }
+        Worker *victim = NULL;
+        for (Worker &other : workers)
+        {
+            if (!victim || other.own.size() > victim->own.size())
+                victim = &other;
+        }
+        if (!victim || victim->own.empty())
+            return false;
+        item = victim->own.back();
+        victim->own.pop_back();
+        ++stats.stolen;
+        return true;
+    }
+
+    void dispatch(Worker &worker)
+    {
+        unsigned int item;
+        while (worker.socket >= 0 && worker.inFlight.size() < (size_t)PREFETCH && take(worker, item))
+        {
+            FarmMessage work = { FarmMessage::WORK, item, 0, 0, 0 };
+            worker.inFlight.push_back(item);
+            if (!sendMessage(worker.socket, work))
+                lose(worker);
+        }
+    }
+
+    void retry(unsigned int item)
+    {
+        if (++attempts[item] >= MAX_ATTEMPTS)
+        {
+            std::cout << "ERROR::FARM:: Item " << item << " failed " << MAX_ATTEMPTS << " times, giving up" << std::endl;
+            ++stats.failed;
+            return;
+        }
+        retries.push_back(item);
+        ++stats.retried;
+    }
+
+    // a worker went away or broke the protocol: stop it for good, what it
+    // had in flight is rendered elsewhere
+    void lose(Worker &worker)
+    {
+        if (!worker.exited)
+            kill(worker.pid, SIGKILL);
+        close(worker.socket);
+        worker.socket = -1;
+        ++stats.workersLost;
+        for (unsigned int item : worker.inFlight)
+            retry(item);
+        worker.inFlight.clear();
+    }
+
+    bool finish(Worker &worker, unsigned int item)
+    {
+        for (size_t i = 0; i < worker.inFlight.size(); ++i)
+        {
+            if (worker.inFlight[i] == item)
+            {
+                worker.inFlight.erase(worker.inFlight.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void receive(Worker &worker, std::vector<unsigned char> &pixels)
+    {
+        FarmMessage message;
+        if (!receiveAll(worker.socket, &message, sizeof(message)))
+        {
+            lose(worker);
+            return;
+        }
+        if (message.size > 0)
+        {
+            pixels.resize(message.size);
+            if (!receiveAll(worker.socket, pixels.data(), message.size))
+            {
+                lose(worker);
+                return;
+            }
+        }
+        if (!finish(worker, message.item))
+            return;
+        if (message.type == FarmMessage::RESULT && message.size == (uint64_t)message.width * message.height * 4)
+        {
+            consumer(message.item, (int)message.width, (int)message.height, pixels.data());
+            ++stats.completed;
+        }
+        else
+            retry(message.item);
+    }
+};
+#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "job_system.h"
+
+// Draw list of one or more passes ordered by 64-bit sort keys. From the most
+// significant bits down a key holds the pass, the depth (front to back), the
+// material and the mesh, so a plain integer sort groups draws by state and
+// orders opaque geometry for early depth rejection. A queue is drawn with one
+// program, bound once at submission, so the key has no program field. Keys are
+// emitted in parallel, each chunk of entities into its own bucket, then
+// radix sorted.
+class RenderQueue
+{
+public:
+    // entities per emit job
+    static constexpr size_t PARALLEL_GRAIN = 4096;
+
+    // key fields, most significant first
+    static constexpr int PASS_BITS = 4, DEPTH_BITS = 24, MATERIAL_BITS = 14, MESH_BITS = 16;
+    static constexpr int MESH_SHIFT = 0;
+    static constexpr int MATERIAL_SHIFT = MESH_SHIFT + MESH_BITS;
+    static constexpr int DEPTH_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+    static constexpr int PASS_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+
+    struct Item
+    {
+        uint64_t key;
+        uint32_t entity;
+    };
+    typedef std::vector<Item> Bucket;
+
+    // per-frame state changes issued and elided at submission
+    struct Stats
+    {
+        size_t draws = 0;
+        size_t programBinds = 0;
+        size_t materialBinds = 0, materialSkipped = 0;
+        size_t meshBinds = 0, meshSkipped = 0;
+        size_t skipped() const { return materialSkipped + meshSkipped; }
+        size_t issued() const { return programBinds + materialBinds + meshBinds; }
+    };
+
+    // depth is any non-negative distance; the top bits of its float encoding
+    // keep the order without a fixed range. Pass depth 0 to sort by state only
+    static uint64_t makeKey(uint32_t pass, float depth, uint32_t material, uint32_t mesh)
+    {
+        uint32_t bits = 0;
+        if (depth > 0.0f)
+            std::memcpy(&bits, &depth, sizeof(bits));
+        return field(pass, PASS_BITS, PASS_SHIFT) | field(bits >> (32 - DEPTH_BITS - 1), DEPTH_BITS, DEPTH_SHIFT) |
+               field(material, MATERIAL_BITS, MATERIAL_SHIFT) | field(mesh, MESH_BITS, MESH_SHIFT);
+    }
+
+    static uint32_t material(uint64_t key) { return (uint32_t)(key >> MATERIAL_SHIFT) & mask(MATERIAL_BITS); }
+    static uint32_t mesh(uint64_t key) { return (uint32_t)(key >> MESH_SHIFT) & mask(MESH_BITS); }
+
+    void clear()
+    {
+        items.clear();
+    }
+
+    // call emit(i, bucket) for every i in [0, count) across the job system,
+    // then append all buckets to the queue
+    // ------------------------------------------------------------------------
+    template <typename Emit>
+    void emit(size_t count, Emit emitItem)
+    {
+        size_t chunks = (count + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN;
+        if (buckets.size() < chunks)
+            buckets.resize(chunks);
+        for (size_t c = 0; c < chunks; ++c)
+            buckets[c].clear();
+        JobSystem::instance().parallelFor(count, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+            Bucket &bucket = buckets[begin / PARALLEL_GRAIN];
+            for (size_t i = begin; i < end; ++i)
+                emitItem(i, bucket);
+        });
+        for (size_t c = 0; c < chunks; ++c)
+            items.insert(items.end(), buckets[c].begin(), buckets[c].end());
+    }
+
+    // LSD radix sort on the key, one byte per pass; bytes every key shares are skipped
+    // ------------------------------------------------------------------------
+    void sort()
+    {
+        const size_t n = items.size();
+        scratch.resize(n);
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t offsets[256] = {};
+            for (const Item &item : items)
+                ++offsets[(item.key >> shift) & 0xff];
+            if (n == 0 || offsets[(items[0].key >> shift) & 0xff] == n)
+                continue;
+            size_t sum = 0;
+            for (size_t &offset : offsets)
+            {
+                size_t count = offset;
+                offset = sum;
+                sum += count;
+            }
+            for (const Item &item : items)
+                scratch[offsets[(item.key >> shift) & 0xff]++] = item;
+            items.swap(scratch);
+        }
+    }
+
+    const std::vector<Item> &sorted() const
+    {
+        return items;
+    }
+
+private:
+    std::vector<Item> items, scratch;
+    std::vector<Bucket> buckets;
+
+    static uint32_t mask(int bits)
+    {
+        return bits >= 32 ? 0xffffffffu : (1u << bits) - 1u;
+    }
+
+    static uint64_t field(uint32_t value, int bits, int shift)
+    {
+        return (uint64_t)(value & mask(bits)) << shift;
+    }
+};
+#endif
\ No newline at end of file
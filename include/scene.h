@@ -0,0 +1,330 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "transform.h"
+#include "culling.h"
+#include "aabb_tree.h"
+
+// object-space bounding box and sphere of a mesh
+struct Bounds
+{
+    glm::vec3 min, max;
+    glm::vec3 center;
+    float radius;
+
+    // bounds of an interleaved vertex array whose first three floats are the position
+    static Bounds fromVertices(const std::vector<float> &vertices, size_t stride)
+    {
+        Bounds b;
+        b.min = b.max = glm::vec3(vertices[0], vertices[1], vertices[2]);
+        for (size_t v = 0; v < vertices.size(); v += stride)
+        {
+            glm::vec3 p(vertices[v], vertices[v + 1], vertices[v + 2]);
+            b.min = glm::min(b.min, p);
+            b.max = glm::max(b.max, p);
+        }
+        b.center = 0.5f * (b.min + b.max);
+        b.radius = 0.0f;
+        for (size_t v = 0; v < vertices.size(); v += stride)
+            b.radius = glm::max(b.radius, glm::length(glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]) - b.center));
+        return b;
+    }
+};
+
+typedef void (*MeshGenerator)(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds);
+
+// Geometry shared by any number of entities. Generated meshes keep their
+// generator so their segment count can be changed at runtime.
+struct Mesh
+{
+    MeshGenerator generate;
+    int nSegments;
+    int builtSegments;
+    std::vector<float> vertices;     // interleaved position/normal
+    std::vector<int> indices;
+    Bounds bounds;
+    // coarse version for the software occlusion rasterizer, same layout
+    std::vector<float> occluderVertices;
+    std::vector<int> occluderIndices;
+    // vertex and index arena allocations, 0 until uploaded
+    uint32_t vertexAllocation, indexAllocation;
+};
+
+struct Material
+{
+    glm::vec3 ambient, diffuse, specular;
+    float alpha;
+};
+
+// entity flags
+enum SceneFlags : uint32_t
+{
+    SCENE_LIT          = 1u << 0,    // drawn by the lighting pass
+    SCENE_CASTS_SHADOW = 1u << 1,    // drawn into the shadow maps
+    SCENE_EMISSIVE     = 1u << 2,    // light source geometry, drawn unlit
+    SCENE_SELECTABLE   = 1u << 3,    // can be picked and outlined
+    SCENE_TRANSPARENT  = 1u << 4,    // material alpha below one
+    SCENE_OCCLUDER     = 1u << 5     // rasterized by the software occlusion culling
+};
+
+// Entity/component scene store. Every component lives in its own dense array
+// and all arrays share the same index, so the transform, culling and draw-list
+// stages stream straight through memory. Removal swaps the last entity into the
+// hole; handles stay valid through an indirection table with generation counts.
+class Scene
+{
+public:
+    struct Handle
+    {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+        bool operator==(const Handle &other) const { return index == other.index && generation == other.generation; }
+        bool operator!=(const Handle &other) const { return !(*this == other); }
+    };
+
+    // transform component (inputs) and per-frame matrices (outputs)
+    TransformSystem transforms;
+    // mesh and material handles index the shared tables below
+    AlignedVector<uint32_t> mesh, material, flags;
+    // world-space bounding spheres and boxes, refreshed by updateBounds()
+    AlignedVector<float> sphereX, sphereY, sphereZ, sphereRadius;
+    AlignedVector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    // leaf of each entity in the spatial index, NULL_NODE until first indexed
+    AlignedVector<int32_t> proxy;
+    // owner of each dense slot
+    std::vector<Handle> entity;
+
+    // dynamic AABB tree over the world boxes; leaves store dense indices
+    AABBTree tree;
+
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+
+    // world bounds in the layout the culling stage consumes
+    BoundsArrays boundsArrays() const
+    {
+        return { sphereX.data(), sphereY.data(), sphereZ.data(), sphereRadius.data(),
+                 minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() };
+    }
+
+    size_t size() const { return entity.size(); }
+
+    uint32_t addMesh(const Mesh &m)
+    {
+        meshes.push_back(m);
+        return (uint32_t)meshes.size() - 1;
+    }
+
+    uint32_t addMaterial(const Material &m)
+    {
+        materials.push_back(m);
+        return (uint32_t)materials.size() - 1;
+    }
+
+    void reserve(size_t count)
+    {
+        for (auto *array : componentArrays())
+            array->reserve(count);
+        mesh.reserve(count);
+        material.reserve(count);
+        proxy.reserve(count);
+        flags.reserve(count);
+        entity.reserve(count);
+        transforms.positionX.reserve(count);
+        transforms.positionY.reserve(count);
+        transforms.positionZ.reserve(count);
+        transforms.scale.reserve(count);
+    }
+
+    Handle create(uint32_t meshId, uint32_t materialId, const glm::vec3 &position, float scale, uint32_t entityFlags)
+    {
+        Handle handle;
+        if (!freeSlots.empty())
+        {
+            handle.index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            handle.index = (uint32_t)slots.size();
+            slots.push_back(Slot());
+        }
+        handle.generation = slots[handle.index].generation;
+
+        size_t i = size();
+        slots[handle.index].dense = (uint32_t)i;
+        entity.push_back(handle);
+        mesh.push_back(meshId);
+        material.push_back(materialId);
+        // see-through entities hide nothing behind them
+        if (materials[materialId].alpha < 1.0f)
+            entityFlags = (entityFlags | SCENE_TRANSPARENT) & ~SCENE_OCCLUDER;
+        flags.push_back(entityFlags);
+        proxy.push_back(AABBTree::NULL_NODE);
+        for (auto *array : componentArrays())
+            array->push_back(0.0f);
+        transforms.resize(i + 1);
+        transforms.set(i, position, scale);
+        return handle;
+    }
+
+    void destroy(Handle handle)
+    {
+        if (!alive(handle))
+            return;
+        size_t i = slots[handle.index].dense;
+        size_t last = size() - 1;
+        if (proxy[i] != AABBTree::NULL_NODE)
+            tree.destroyProxy(proxy[i]);
+        if (i != last)
+        {
+            // move the last entity into the hole
+            entity[i] = entity[last];
+            slots[entity[i].index].dense = (uint32_t)i;
+            mesh[i] = mesh[last];
+            material[i] = material[last];
+            flags[i] = flags[last];
+            proxy[i] = proxy[last];
+            if (proxy[i] != AABBTree::NULL_NODE)
+                tree.setUserData(proxy[i], (uint32_t)i);
+            for (auto *array : componentArrays())
+                (*array)[i] = (*array)[last];
+            transforms.set(i, glm::vec3(transforms.positionX[last], transforms.positionY[last], transforms.positionZ[last]), transforms.scale[last]);
+        }
+        entity.pop_back();
+        mesh.pop_back();
+        material.pop_back();
+        flags.pop_back();
+        proxy.pop_back();
+        for (auto *array : componentArrays())
+            array->pop_back();
+        transforms.resize(last);
+
+        ++slots[handle.index].generation;
+        freeSlots.push_back(handle.index);
+    }
+
+    bool alive(Handle handle) const
+    {
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+    // dense index of a live entity
+    size_t indexOf(Handle handle) const
+    {
+        return slots[handle.index].dense;
+    }
+
+    void setPosition(Handle handle, const glm::vec3 &position)
+    {
+        size_t i = indexOf(handle);
+        transforms.set(i, position, transforms.scale[i]);
+    }
+
+    glm::vec3 getPosition(size_t i) const
+    {
+        return glm::vec3(transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i]);
+    }
+
+    // world bounds from each mesh's object-space bounds and the entity's
+    // translation/uniform scale
+    // ------------------------------------------------------------------------
+    void updateBounds()
+    {
+        JobSystem::instance().parallelFor(size(), TransformSystem::PARALLEL_GRAIN, [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const Mesh &m = meshes[mesh[i]];
+                float s = transforms.scale[i];
+                float px = transforms.positionX[i], py = transforms.positionY[i], pz = transforms.positionZ[i];
+                sphereX[i] = px + s * m.bounds.center.x;
+                sphereY[i] = py + s * m.bounds.center.y;
+                sphereZ[i] = pz + s * m.bounds.center.z;
+                sphereRadius[i] = s * m.bounds.radius;
+                minX[i] = px + s * m.bounds.min.x;
+                minY[i] = py + s * m.bounds.min.y;
+                minZ[i] = pz + s * m.bounds.min.z;
+                maxX[i] = px + s * m.bounds.max.x;
+                maxY[i] = py + s * m.bounds.max.y;
+                maxZ[i] = pz + s * m.bounds.max.z;
+            }
+        });
+        updateTree();
+    }
+
+    AABB worldBox(size_t i) const
+    {
+        return { glm::vec3(minX[i], minY[i], minZ[i]), glm::vec3(maxX[i], maxY[i], maxZ[i]) };
+    }
+
+    // keep the tree in step with the world boxes. Bulk loads (mostly new
+    // entities) rebuild it balanced in one go; otherwise new entities are
+    // inserted and moved ones reinserted only when they leave their fat box
+    // ------------------------------------------------------------------------
+    void updateTree()
+    {
+        size_t pending = 0;
+        for (size_t i = 0; i < size(); ++i)
+            pending += proxy[i] == AABBTree::NULL_NODE;
+        if (pending > 0 && pending >= size() / 2)
+        {
+            rebuildTree();
+            return;
+        }
+        for (size_t i = 0; i < size(); ++i)
+        {
+            if (proxy[i] == AABBTree::NULL_NODE)
+                proxy[i] = tree.createProxy(worldBox(i), (uint32_t)i);
+            else
+                tree.moveProxy(proxy[i], worldBox(i));
+        }
+    }
+
+    void rebuildTree()
+    {
+        std::vector<AABB> boxes(size());
+        std::vector<uint32_t> indices(size());
+        std::vector<int> leaves(size());
+        for (size_t i = 0; i < size(); ++i)
+        {
+            boxes[i] = worldBox(i);
+            indices[i] = (uint32_t)i;
+        }
+        tree.build(boxes.data(), indices.data(), size(), leaves.data());
+        for (size_t i = 0; i < size(); ++i)
+            proxy[i] = leaves[i];
+    }
+
+    // nearest entity with one of the mask's flags whose world box the ray hits
+    Handle pick(const glm::vec3 &origin, const glm::vec3 &direction, uint32_t mask, float maxDistance = 1000.0f) const
+    {
+        glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        uint32_t hit = 0;
+        float t = tree.raycast(origin, direction, maxDistance, [&](uint32_t i, float maxT) {
+            if (!(flags[i] & mask))
+                return -1.0f;
+            return worldBox(i).rayEntry(origin, invDir, maxT);
+        }, hit);
+        return t < 0.0f ? Handle() : entity[hit];
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0;
+        uint32_t generation = 0;
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+
+    std::vector<AlignedVector<float> *> componentArrays()
+    {
+        return { &sphereX, &sphereY, &sphereZ, &sphereRadius, &minX, &minY, &minZ, &maxX, &maxY, &maxZ };
+    }
+};
+#endif
\ No newline at end of file
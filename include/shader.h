@@ -4,10 +4,95 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <array>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+
+#include "gl_state.h"
+
+// read a whole shader source file; reports and returns an empty string on failure
+inline std::string readShaderFile(const char* path)
+{
+    std::ifstream shaderFile;
+    // ensure ifstream objects can throw exceptions:
+    shaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+    try 
+    {
+        shaderFile.open(path);
+        std::stringstream shaderStream;
+        shaderStream << shaderFile.rdbuf();
+        shaderFile.close();
+        return shaderStream.str();
+    }
+    catch (std::ifstream::failure& e)
+    {
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << " " << e.what() << std::endl;
+    }
+    return std::string();
+}
+
+// utility function for checking shader compilation/linking errors.
+// ------------------------------------------------------------------------
+inline void checkCompileErrors(GLuint shader, std::string type)
+{
+    GLint success;
+    GLchar infoLog[1024];
+    if (type != "PROGRAM")
+    {
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+        }
+    }
+    else
+    {
+        glGetProgramiv(shader, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(shader, 1024, NULL, infoLog);
+            std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+        }
+    }
+}
+
+// program pipelines (GL_ARB_separate_shader_objects) are core since OpenGL 4.1
+inline bool separableShadersSupported()
+{
+    return GLAD_GL_VERSION_4_1;
+}
+
+// A single shader stage compiled once into a separable program, so the same
+// vertex or fragment stage can be mixed into several Shader pipelines without
+// recompiling or relinking. Without pipeline support only the source is kept
+// and every Shader built from it links a monolithic program instead.
+class ShaderStage
+{
+public:
+    unsigned int ID;
+    GLenum type;
+    std::string source;
+
+    // defines (e.g. "#define FOO\n") are inserted right after the #version line
+    ShaderStage(GLenum type, const char* path, const std::string &defines = "") : ID(0), type(type)
+    {
+        source = readShaderFile(path);
+        if (!defines.empty())
+        {
+            std::string::size_type versionEnd = source.find('\n');
+            source.insert(versionEnd == std::string::npos ? source.size() : versionEnd + 1, defines);
+        }
+        if (!separableShadersSupported())
+            return;
+        const char* code = source.c_str();
+        ID = glCreateShaderProgramv(type, 1, &code);
+        checkCompileErrors(ID, "PROGRAM");
+    }
+};
 
 class Shader
 {
@@ -15,151 +100,249 @@ public:
     unsigned int ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath) : separable(false)
     {
         // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-        }
-        catch (std::ifstream::failure& e)
+        std::string vertexCode = readShaderFile(vertexPath);
+        std::string fragmentCode = readShaderFile(fragmentPath);
+        // 2. compile and link them into one program
+        link(vertexCode, fragmentCode);
+    }
+    // constructor mixing precompiled stages at bind time through a program pipeline
+    // ------------------------------------------------------------------------
+    Shader(const ShaderStage& vertexStage, const ShaderStage& fragmentStage) : separable(false)
+    {
+        if (!vertexStage.ID || !fragmentStage.ID)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
+            link(vertexStage.source, fragmentStage.source);
+            return;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        separable = true;
+        stageCount = 2;
+        stages[0] = vertexStage.ID;
+        stages[1] = fragmentStage.ID;
+        glGenProgramPipelines(1, &ID);
+        glUseProgramStages(ID, GL_VERTEX_SHADER_BIT, vertexStage.ID);
+        glUseProgramStages(ID, GL_FRAGMENT_SHADER_BIT, fragmentStage.ID);
+    }
+    // constructor for a compute pipeline; dispatch after use()
+    // ------------------------------------------------------------------------
+    explicit Shader(const ShaderStage& computeStage) : separable(true)
+    {
+        stageCount = 1;
+        stages[0] = computeStage.ID;
+        glGenProgramPipelines(1, &ID);
+        glUseProgramStages(ID, GL_COMPUTE_SHADER_BIT, computeStage.ID);
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     { 
-        glUseProgram(ID); 
+        if (separable)
+        {
+            // a bound program overrides the pipeline binding
+            GLState::instance().useProgram(0);
+            GLState::instance().bindProgramPipeline(ID);
+        }
+        else
+            GLState::instance().useProgram(ID);
     }
-    // utility uniform functions
+    // utility uniform functions; they write to this shader's programs
+    // whichever is bound, except without OpenGL 4.1, where the shader must
+    // be in use
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setUniform(name, (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setUniform(name, value);
+    }
+    // ------------------------------------------------------------------------
+    void setUint(const std::string &name, unsigned int value) const
+    {
+        setUniform(name, value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setUniform(name, value); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setUniform(name, value); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setUniform(name, glm::vec2(x, y)); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setUniform(name, value); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setUniform(name, glm::vec3(x, y, z)); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setUniform(name, value); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setUniform(name, glm::vec4(x, y, z, w)); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setUniform(name, mat);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setUniform(name, mat);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setUniform(name, mat);
     }
 
 private:
-    // utility function for checking shader compilation/linking errors.
+    bool separable;
+    int stageCount = 0;
+    unsigned int stages[2];
+    mutable std::unordered_map<std::string, std::array<GLint, 2>> locations;
+
+    // compile and link a monolithic program from vertex/fragment source
+    // ------------------------------------------------------------------------
+    void link(const std::string &vertexCode, const std::string &fragmentCode)
+    {
+        const char* vShaderCode = vertexCode.c_str();
+        const char * fShaderCode = fragmentCode.c_str();
+        unsigned int vertex, fragment;
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+        // shader Program
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+    }
+    // the uniform's location in the program or in each stage, -1 where it is
+    // not declared; looked up on first use, since a setter runs per draw
+    // ------------------------------------------------------------------------
+    const std::array<GLint, 2> &locationsOf(const std::string &name) const
+    {
+        auto found = locations.find(name);
+        if (found != locations.end())
+            return found->second;
+        std::array<GLint, 2> location = {{ -1, -1 }};
+        if (!separable)
+            location[0] = glGetUniformLocation(ID, name.c_str());
+        for (int i = 0; separable && i < stageCount; ++i)
+            location[i] = glGetUniformLocation(stages[i], name.c_str());
+        return locations.emplace(name, location).first->second;
+    }
+    // set the uniform in every stage that declares it
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    template <typename T>
+    void setUniform(const std::string &name, const T &value) const
     {
-        GLint success;
-        GLchar infoLog[1024];
-        if (type != "PROGRAM")
+        const std::array<GLint, 2> &location = locationsOf(name);
+        if (!separable)
         {
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-            if (!success)
-            {
-                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
+            upload(ID, location[0], value);
+            return;
         }
-        else
+        for (int i = 0; i < stageCount; ++i)
         {
-            glGetProgramiv(shader, GL_LINK_STATUS, &success);
-            if (!success)
-            {
-                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
+            if (location[i] != -1)
+                upload(stages[i], location[i], value);
         }
     }
+    // glProgramUniform* (OpenGL 4.1) does not depend on the bound program or
+    // pipeline; older contexts have only monolithic programs and glUniform*
+    // ------------------------------------------------------------------------
+    static void upload(GLuint program, GLint location, int value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform1i(program, location, value);
+        else
+            glUniform1i(location, value);
+    }
+    static void upload(GLuint program, GLint location, unsigned int value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform1ui(program, location, value);
+        else
+            glUniform1ui(location, value);
+    }
+    static void upload(GLuint program, GLint location, float value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform1f(program, location, value);
+        else
+            glUniform1f(location, value);
+    }
+    static void upload(GLuint program, GLint location, const glm::vec2 &value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform2fv(program, location, 1, &value[0]);
+        else
+            glUniform2fv(location, 1, &value[0]);
+    }
+    static void upload(GLuint program, GLint location, const glm::vec3 &value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform3fv(program, location, 1, &value[0]);
+        else
+            glUniform3fv(location, 1, &value[0]);
+    }
+    static void upload(GLuint program, GLint location, const glm::vec4 &value)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniform4fv(program, location, 1, &value[0]);
+        else
+            glUniform4fv(location, 1, &value[0]);
+    }
+    static void upload(GLuint program, GLint location, const glm::mat2 &mat)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniformMatrix2fv(program, location, 1, GL_FALSE, &mat[0][0]);
+        else
+            glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+    static void upload(GLuint program, GLint location, const glm::mat3 &mat)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, &mat[0][0]);
+        else
+            glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+    static void upload(GLuint program, GLint location, const glm::mat4 &mat)
+    {
+        if (GLAD_GL_VERSION_4_1)
+            glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, &mat[0][0]);
+        else
+            glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,227 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// One axis of a benchmark sweep: a setting of the renderer and the values it
+// takes. The sweep measures every combination of the axes' values.
+struct SweepAxis
+{
+    std::string name;
+    std::vector<std::string> values;
+};
+
+// the command line options that set an axis to a value, false if the axis
+// is unknown or the value malformed
+inline bool sweepOption(const std::string &axis, const std::string &value, std::vector<std::string> &arguments)
+{
+    static const char *const names[] = { "instances", "lights", "segments", "shadow" };
+    static const char *const options[] = { "--instances", "--lights", "--segments", "--shadow-size" };
+    if (axis == "size")
+    {
+        size_t x = value.find('x');
+        if (x == std::string::npos || x == 0 || x + 1 == value.size() ||
+            value.find_first_not_of("0123456789x") != std::string::npos || value.find('x', x + 1) != std::string::npos)
+            return false;
+        arguments.push_back("--size");
+        arguments.push_back(value.substr(0, x));
+        arguments.push_back(value.substr(x + 1));
+        return true;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        if (axis == names[i])
+        {
+            if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+            arguments.push_back(options[i]);
+            arguments.push_back(value);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool lightsWithin(const std::vector<std::string> &values, int maxLights)
+{
+    for (const std::string &value : values)
+    {
+        int lights = std::atoi(value.c_str());
+        if (value.size() > 9 || lights < 1 || lights > maxLights)
+            return false;
+    }
+    return true;
+}
+
+// Read a sweep file: one axis per line, its name and then its values, from
+//   instances n ...     copies of the generated primitives
+//   lights n ...        lights that shine and cast shadows
+//   segments n ...      segments of every primitive
+//   shadow n ...        shadow map size
+//   size WxH ...        render target size
+// Blank lines and lines starting with # are skipped; a malformed line, or a
+// lights line asking for more than maxLights, is reported and dropped.
+// Returns false if the file cannot be read or names no axis.
+inline bool loadSweep(const std::string &path, int maxLights, std::vector<SweepAxis> &axes)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::SWEEP:: Failed to read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+    {
+        std::istringstream tokens(line);
+        SweepAxis axis;
+        if (!(tokens >> axis.name) || axis.name[0] == '#')
+            continue;
+        bool valid = true;
+        std::string value;
+        std::vector<std::string> arguments;
+        while (valid && tokens >> value)
+        {
+            valid = sweepOption(axis.name, value, arguments);
+            axis.values.push_back(value);
+        }
+        if (!valid || axis.values.empty())
+            std::cout << "ERROR::SWEEP:: " << path << ":" << number << ": cannot parse axis '" << axis.name << "', skipped" << std::endl;
+        else if (axis.name == "lights" && !lightsWithin(axis.values, maxLights))
+            std::cout << "ERROR::SWEEP:: " << path << ":" << number << ": lights must be 1 to " << maxLights << ", skipped" << std::endl;
+        else
+            axes.push_back(axis);
+    }
+    if (axes.empty())
+    {
+        std::cout << "ERROR::SWEEP:: " << path << " names no axis" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+// an argument quoted the way the C runtime splits a command line back up
+inline std::string quoteWindowsArgument(const std::string &argument)
+{
+    std::string quoted = "\"";
+    size_t backslashes = 0;
+    for (char c : argument)
+    {
+        if (c == '\\')
+        {
+            ++backslashes;
+            continue;
+        }
+        // backslashes are literal unless a quote follows them
+        quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+        backslashes = 0;
+        quoted += c;
+    }
+    quoted.append(backslashes * 2, '\\');
+    return quoted + "\"";
+}
+#endif
+
+// Run arguments[0], found like the shell would, with the arguments, append
+// its output to log and wait for it; true if it exited with status 0. No
+// shell sees the arguments, so paths, labels and values reach the run as
+// they are whatever characters they hold.
+inline bool runSweepProcess(const std::vector<std::string> &arguments, const std::string &log)
+{
+#ifdef _WIN32
+    // _spawnv joins the arguments into one command line
+    std::vector<std::string> quoted;
+    for (const std::string &argument : arguments)
+        quoted.push_back(quoteWindowsArgument(argument));
+    std::vector<const char *> argv;
+    for (const std::string &argument : quoted)
+        argv.push_back(argument.c_str());
+    argv.push_back(NULL);
+    int output = _open(log.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND, _S_IREAD | _S_IWRITE);
+    if (output < 0)
+    {
+        std::cout << "ERROR::SWEEP:: Failed to open " << log << std::endl;
+        return false;
+    }
+    // the child inherits standard output and error, pointed at the log meanwhile
+    std::fflush(stdout);
+    std::fflush(stderr);
+    int savedOutput = _dup(1), savedError = _dup(2);
+    _dup2(output, 1);
+    _dup2(output, 2);
+    intptr_t status = _spawnvp(_P_WAIT, arguments[0].c_str(), argv.data());
+    _dup2(savedOutput, 1);
+    _dup2(savedError, 2);
+    _close(savedOutput);
+    _close(savedError);
+    _close(output);
+    return status == 0;
+#else
+    // built before fork(): the child only redirects, execs or exits
+    std::vector<char *> argv;
+    for (const std::string &argument : arguments)
+        argv.push_back((char *)argument.c_str());
+    argv.push_back(NULL);
+    int output = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (output < 0)
+    {
+        std::cout << "ERROR::SWEEP:: Failed to open " << log << std::endl;
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(output, 1);
+        dup2(output, 2);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(output);
+    int status = 0;
+    pid_t waited = -1;
+    while (pid > 0 && (waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+        ;
+    return waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// the value index of every axis in configuration n of the grid; the first
+// axis changes slowest
+inline std::vector<size_t> sweepConfiguration(const std::vector<SweepAxis> &axes, size_t n)
+{
+    std::vector<size_t> indices(axes.size());
+    for (size_t a = axes.size(); a-- > 0;)
+    {
+        indices[a] = n % axes[a].values.size();
+        n /= axes[a].values.size();
+    }
+    return indices;
+}
+
+inline size_t sweepSize(const std::vector<SweepAxis> &axes)
+{
+    size_t size = 1;
+    for (const SweepAxis &axis : axes)
+        size *= axis.values.size();
+    return size;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+#include <glm/simd/matrix.h>
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <mm_malloc.h>
+
+#include "job_system.h"
+
+// allocator keeping arrays on cache-line boundaries so SIMD loads/stores are aligned
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n)
+    {
+        void *p = _mm_malloc(n * sizeof(T), Alignment);
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t) { _mm_free(p); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Computes the world, normal and model-view-projection matrices of every scene
+// object once per frame. Inputs and outputs are kept as separate contiguous
+// arrays (structure of arrays) so each pass only streams the matrices it uses,
+// and large scenes are split across the job system.
+class TransformSystem
+{
+public:
+    // objects per job; below this the whole update runs on the calling thread
+    static constexpr size_t PARALLEL_GRAIN = 4096;
+
+    // inputs: translation and uniform scale per object
+    AlignedVector<float> positionX, positionY, positionZ, scale;
+    // outputs
+    AlignedVector<glm::mat4> world;
+    AlignedVector<glm::mat4> normal;    // inverse-transpose of world, upper 3x3 is used
+    AlignedVector<glm::mat4> mvp;       // viewCount arrays of size() matrices, view-major
+
+    size_t size() const { return scale.size(); }
+    int viewCount() const { return views; }
+
+    void resize(size_t count)
+    {
+        positionX.resize(count, 0.0f);
+        positionY.resize(count, 0.0f);
+        positionZ.resize(count, 0.0f);
+        scale.resize(count, 1.0f);
+        world.resize(count);
+        normal.resize(count);
+        mvp.resize(count * views);
+    }
+
+    void set(size_t i, const glm::vec3 &position, float s)
+    {
+        positionX[i] = position.x;
+        positionY[i] = position.y;
+        positionZ[i] = position.z;
+        scale[i] = s;
+    }
+
+    const glm::mat4 &getMVP(int view, size_t i) const
+    {
+        return mvp[view * size() + i];
+    }
+
+    // rebuild all matrices for the given view-projections (camera, lights, ...)
+    // ------------------------------------------------------------------------
+    void update(const glm::mat4 *viewProjections, int viewCount)
+    {
+        if (viewCount != views)
+        {
+            views = viewCount;
+            mvp.resize(size() * views);
+        }
+        JobSystem::instance().parallelFor(size(), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+            updateRange(viewProjections, begin, end);
+        });
+    }
+
+private:
+    int views = 1;
+
+    void updateRange(const glm::mat4 *viewProjections, size_t begin, size_t end)
+    {
+        const size_t count = size();
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+        glm_vec4 vp[8][4];
+        const int cachedViews = views < 8 ? views : 8;
+        for (int v = 0; v < cachedViews; ++v)
+            loadUnaligned(viewProjections[v], vp[v]);
+        for (size_t i = begin; i < end; ++i)
+        {
+            // world = translate(position) * scale(s)
+            glm_vec4 w[4], inverse[4], n[4], m[4], view[4];
+            w[0] = _mm_set_ps(0.0f, 0.0f, 0.0f, scale[i]);
+            w[1] = _mm_set_ps(0.0f, 0.0f, scale[i], 0.0f);
+            w[2] = _mm_set_ps(0.0f, scale[i], 0.0f, 0.0f);
+            w[3] = _mm_set_ps(1.0f, positionZ[i], positionY[i], positionX[i]);
+            store(w, world[i]);
+            glm_mat4_inverse(w, inverse);
+            glm_mat4_transpose(inverse, n);
+            store(n, normal[i]);
+            for (int v = 0; v < views; ++v)
+            {
+                if (v < cachedViews)
+                    glm_mat4_mul(vp[v], w, m);
+                else
+                {
+                    loadUnaligned(viewProjections[v], view);
+                    glm_mat4_mul(view, w, m);
+                }
+                store(m, mvp[v * count + i]);
+            }
+        }
+#else
+        for (size_t i = begin; i < end; ++i)
+        {
+            world[i] = glm::mat4(scale[i]);
+            world[i][3] = glm::vec4(positionX[i], positionY[i], positionZ[i], 1.0f);
+            normal[i] = glm::transpose(glm::inverse(world[i]));
+            for (int v = 0; v < views; ++v)
+                mvp[v * count + i] = viewProjections[v] * world[i];
+        }
+#endif
+    }
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+    // caller-provided matrices carry no alignment guarantee
+    static void loadUnaligned(const glm::mat4 &m, glm_vec4 out[4])
+    {
+        for (int c = 0; c < 4; ++c)
+            out[c] = _mm_loadu_ps(&m[c][0]);
+    }
+    // output arrays are cache-line aligned
+    static void store(const glm_vec4 in[4], glm::mat4 &m)
+    {
+        for (int c = 0; c < 4; ++c)
+            _mm_store_ps(&m[c][0], in[c]);
+    }
+#endif
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,334 @@
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDEO_STREAM_SSE2 1
+#endif
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include "readback.h"
+
+// BT.601 full-range RGB to YCbCr in 8.8 fixed point, as the JPEG flavor of
+// Y4M (C420jpeg) expects; chroma from the rounded mean of each 2 x 2 block.
+// The SIMD path computes exactly the same values, 8 pixels at a time.
+// ----------------------------------------------------------------------------
+inline unsigned char lumaOf(const unsigned char *p)
+{
+    return (unsigned char)((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+}
+
+// one pair of output rows from x on, top and bottom as RGBA8; an odd last
+// column or row is paired with itself
+inline void convertRowPairScalar(const unsigned char *top, const unsigned char *bottom, int x, int width,
+                                 unsigned char *yTop, unsigned char *yBottom, unsigned char *u, unsigned char *v)
+{
+    for (; x < width; x += 2)
+    {
+        int right = x + 1 < width ? x + 1 : x;
+        const unsigned char *block[4] = { top + x * 4, top + right * 4, bottom + x * 4, bottom + right * 4 };
+        yTop[x] = lumaOf(block[0]);
+        if (x + 1 < width)
+            yTop[x + 1] = lumaOf(block[1]);
+        if (yBottom)
+        {
+            yBottom[x] = lumaOf(block[2]);
+            if (x + 1 < width)
+                yBottom[x + 1] = lumaOf(block[3]);
+        }
+        int r = 2, g = 2, b = 2;
+        for (const unsigned char *p : block)
+        {
+            r += p[0];
+            g += p[1];
+            b += p[2];
+        }
+        r >>= 2;
+        g >>= 2;
+        b >>= 2;
+        // + 128 rounds, + 128 << 8 centers; only pure blue or red reach 256
+        int cb = (-43 * r - 85 * g + 128 * b + 32896) >> 8, cr = (128 * r - 107 * g - 21 * b + 32896) >> 8;
+        u[x / 2] = (unsigned char)(cb < 255 ? cb : 255);
+        v[x / 2] = (unsigned char)(cr < 255 ? cr : 255);
+    }
+}
+
+#ifdef VIDEO_STREAM_SSE2
+// the red, green and blue of 8 RGBA8 pixels as 16-bit lanes
+inline void splitChannels(const unsigned char *pixels, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i low = _mm_set1_epi32(0xff);
+    __m128i first = _mm_loadu_si128((const __m128i *)pixels);
+    __m128i second = _mm_loadu_si128((const __m128i *)(pixels + 16));
+    r = _mm_packs_epi32(_mm_and_si128(first, low), _mm_and_si128(second, low));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(first, 8), low), _mm_and_si128(_mm_srli_epi32(second, 8), low));
+    b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(first, 16), low), _mm_and_si128(_mm_srli_epi32(second, 16), low));
+}
+
+// Y of 8 pixels: the weighted sum stays below 2^16, so unsigned 16-bit
+// lanes hold it
+inline void storeLuma(__m128i r, __m128i g, __m128i b, unsigned char *y)
+{
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150))),
+                                _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(29)), _mm_set1_epi16(128)));
+    _mm_storel_epi64((__m128i *)y, _mm_packus_epi16(_mm_srli_epi16(sum, 8), _mm_setzero_si128()));
+}
+
+// rounded mean of the 2 x 2 blocks of two rows of 8 values, 4 16-bit lanes
+inline __m128i blockMean(__m128i top, __m128i bottom)
+{
+    __m128i sum = _mm_madd_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(1));
+    __m128i mean = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+    return _mm_packs_epi32(mean, mean);
+}
+
+// 4 chroma samples: the 16-bit products are summed in 32 bits by madd,
+// with the rounding and centering constant as a pair of 2 x 16448
+inline void storeChroma(__m128i rg, __m128i b2, __m128i rgWeights, __m128i bWeights, unsigned char *target)
+{
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(rg, rgWeights), _mm_madd_epi16(b2, bWeights));
+    __m128i c = _mm_srai_epi32(sum, 8);
+    c = _mm_packus_epi16(_mm_packs_epi32(c, c), _mm_setzero_si128());
+    int bytes = _mm_cvtsi128_si32(c);
+    std::memcpy(target, &bytes, 4);
+}
+
+inline void convertRowPairSSE2(const unsigned char *top, const unsigned char *bottom, int width,
+                               unsigned char *yTop, unsigned char *yBottom, unsigned char *u, unsigned char *v)
+{
+    const __m128i uRG = _mm_setr_epi16(-43, -85, -43, -85, -43, -85, -43, -85);
+    const __m128i uB = _mm_setr_epi16(128, 16448, 128, 16448, 128, 16448, 128, 16448);
+    const __m128i vRG = _mm_setr_epi16(128, -107, 128, -107, 128, -107, 128, -107);
+    const __m128i vB = _mm_setr_epi16(-21, 16448, -21, 16448, -21, 16448, -21, 16448);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i rt, gt, bt, rb, gb, bb;
+        splitChannels(top + x * 4, rt, gt, bt);
+        splitChannels(bottom + x * 4, rb, gb, bb);
+        storeLuma(rt, gt, bt, yTop + x);
+        if (yBottom)
+            storeLuma(rb, gb, bb, yBottom + x);
+        __m128i r = blockMean(rt, rb), g = blockMean(gt, gb), b = blockMean(bt, bb);
+        __m128i rg = _mm_unpacklo_epi16(r, g);
+        __m128i b2 = _mm_unpacklo_epi16(b, _mm_set1_epi16(2));
+        storeChroma(rg, b2, uRG, uB, u + x / 2);
+        storeChroma(rg, b2, vRG, vB, v + x / 2);
+    }
+    convertRowPairScalar(top, bottom, x, width, yTop, yBottom, u, v);
+}
+#endif
+
+// bottom-up RGBA8, as read back, to top-down planar YUV 4:2:0: a width x
+// height Y plane, then (width + 1) / 2 x (height + 1) / 2 U and V planes
+inline void convertToYUV420(const unsigned char *rgba, int width, int height, unsigned char *yuv)
+{
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    unsigned char *yPlane = yuv, *uPlane = yuv + (size_t)width * height, *vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+    for (int row = 0; row < height; row += 2)
+    {
+        const unsigned char *top = rgba + (size_t)(height - 1 - row) * width * 4;
+        bool pair = row + 1 < height;
+        const unsigned char *bottom = pair ? top - (size_t)width * 4 : top;
+        unsigned char *yTop = yPlane + (size_t)row * width;
+        unsigned char *yBottom = pair ? yTop + width : NULL;
+        unsigned char *u = uPlane + (size_t)(row / 2) * chromaWidth, *v = vPlane + (size_t)(row / 2) * chromaWidth;
+#ifdef VIDEO_STREAM_SSE2
+        convertRowPairSSE2(top, bottom, width, yTop, yBottom, u, v);
+#else
+        convertRowPairScalar(top, bottom, 0, width, yTop, yBottom, u, v);
+#endif
+    }
+}
+
+// Streams frames to a FIFO or file for an external encoder to consume,
+// e.g. 'ffmpeg -i pipe' or, for RGB, 'ffmpeg -f rawvideo -pix_fmt rgb24
+// -s WxH -r FPS -i pipe'. Frames come
+// from a FrameReadback with holdFrames set: submit() only queues the mapped
+// pixel buffer, and the stream's thread converts it from there into the
+// output layout, releases it and writes the frame with one call. The ring's
+// slots bound the queue, so a slow reader stalls capture() rather than
+// piling up frames.
+class VideoStream
+{
+public:
+    enum Format
+    {
+        STREAM_Y4M,     // YUV4MPEG2, 4:2:0 full range
+        STREAM_RGB      // raw RGB24 rows, top-down, no header
+    };
+
+    struct Stats
+    {
+        uint64_t frames = 0;
+        // frames lost because the reader went away
+        uint64_t dropped = 0;
+        double convertMilliseconds = 0.0;
+        double writeMilliseconds = 0.0;
+    };
+
+    VideoStream(const std::string &path, int width, int height, int fps, Format format)
+        : width(width), height(height), format(format)
+    {
+#ifndef _WIN32
+        // a reader that quits should end the stream, not the program
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        // opening a FIFO waits here until the reader opens it too
+        file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "ERROR::VIDEO_STREAM:: Failed to open " << path << std::endl;
+            return;
+        }
+        std::setvbuf(file, NULL, _IONBF, 0);
+        if (format == STREAM_Y4M)
+        {
+            std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(fps) + ":1 Ip A1:1 C420jpeg\n";
+            broken = std::fwrite(header.data(), 1, header.size(), file) != header.size();
+        }
+        thread = std::thread([this] { streamLoop(); });
+    }
+
+    ~VideoStream()
+    {
+        if (thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            work.notify_all();
+            thread.join();
+        }
+        if (file)
+            std::fclose(file);
+    }
+
+    VideoStream(const VideoStream &) = delete;
+    VideoStream &operator=(const VideoStream &) = delete;
+
+    bool valid() const
+    {
+        return file != NULL;
+    }
+
+    // queue a frame of source, which must hold frames; it is released once
+    // converted
+    // ------------------------------------------------------------------------
+    void submit(const FrameReadback::Frame &frame, FrameReadback &source)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frames.push_back({ frame.index, frame.rgba, &source });
+        }
+        work.notify_one();
+    }
+
+    // wait until every queued frame is written
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return frames.empty() && !busy; });
+    }
+
+    Stats statistics()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Pending
+    {
+        uint64_t index;
+        const unsigned char *rgba;
+        FrameReadback *source;
+    };
+
+    int width, height;
+    Format format;
+    std::FILE *file = NULL;
+    bool broken = false;
+    std::thread thread;
+    std::deque<Pending> frames;
+    std::mutex mutex;
+    std::condition_variable work, idle;
+    bool busy = false;
+    bool quit = false;
+    Stats stats;
+
+    void streamLoop()
+    {
+        // "FRAME\n" and the frame, so each frame is a single write
+        static const std::string FRAME_HEADER = "FRAME\n";
+        size_t header = format == STREAM_Y4M ? FRAME_HEADER.size() : 0;
+        size_t pixels = format == STREAM_Y4M ? (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2)
+                                             : (size_t)width * height * 3;
+        std::vector<unsigned char> output(header + pixels);
+        std::memcpy(output.data(), FRAME_HEADER.data(), header);
+        for (;;)
+        {
+            Pending frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work.wait(lock, [this] { return quit || !frames.empty(); });
+                if (frames.empty())
+                    return;
+                frame = frames.front();
+                frames.pop_front();
+                busy = true;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (format == STREAM_Y4M)
+                convertToYUV420(frame.rgba, width, height, &output[header]);
+            else
+            {
+                unsigned char *target = &output[0];
+                for (int y = height - 1; y >= 0; --y)
+                {
+                    const unsigned char *source = frame.rgba + (size_t)y * width * 4;
+                    for (int x = 0; x < width; ++x, target += 3)
+                    {
+                        target[0] = source[x * 4 + 0];
+                        target[1] = source[x * 4 + 1];
+                        target[2] = source[x * 4 + 2];
+                    }
+                }
+            }
+            frame.source->release(frame.index);
+            std::chrono::steady_clock::time_point converted = std::chrono::steady_clock::now();
+            bool written = !broken && std::fwrite(output.data(), 1, output.size(), file) == output.size();
+            if (!written && !broken)
+                std::cout << "ERROR::VIDEO_STREAM:: The reader went away, dropping the remaining frames" << std::endl;
+            broken = !written;
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++(written ? stats.frames : stats.dropped);
+                stats.convertMilliseconds += std::chrono::duration<double, std::milli>(converted - start).count();
+                stats.writeMilliseconds += std::chrono::duration<double, std::milli>(end - converted).count();
+                busy = false;
+            }
+            idle.notify_all();
+        }
+    }
+};
+#endif
\ No newline at end of file
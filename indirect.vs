@@ -0,0 +1,44 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+// entity index from the culled instance list; the draw's baseInstance selects the list
+layout (location = 2) in uint aEntity;
+
+#define NUM_LIGHTS 2
+
+// per-entity data uploaded once per frame, indexed by entity
+layout (std430, binding = 0) readonly buffer Worlds { mat4 worlds[]; };
+layout (std430, binding = 1) readonly buffer Normals { mat4 normals[]; };
+// mesh, material and flags as three arrays of entityCount
+layout (std430, binding = 3) readonly buffer Entities { uint entities[]; };
+layout (std430, binding = 4) readonly buffer Materials { vec4 materials[]; };   // ambient+alpha, diffuse, specular
+
+out gl_PerVertex { vec4 gl_Position; };
+out vec3 FragPos;
+out vec3 Normal;
+out vec4 FragPosLightSpaces[NUM_LIGHTS];
+flat out vec4 MaterialAmbient;
+flat out vec3 MaterialDiffuse;
+flat out vec3 MaterialSpecular;
+
+uniform uint entityCount;
+uniform mat4 viewProjection;
+uniform mat4 lightSpaceMatrixs[NUM_LIGHTS];
+
+// the depth prepass runs this stage too and must match exactly
+invariant gl_Position;
+
+void main()
+{
+    vec4 worldPos = worlds[aEntity] * vec4(aPos, 1.0);
+    FragPos = worldPos.xyz;
+    Normal = mat3(normals[aEntity]) * aNormal;
+    for(int i=0;i<NUM_LIGHTS;++i){
+        FragPosLightSpaces[i] = lightSpaceMatrixs[i] * worldPos;
+    }
+    uint material = entities[entityCount + aEntity];
+    MaterialAmbient = materials[3 * material];
+    MaterialDiffuse = materials[3 * material + 1].rgb;
+    MaterialSpecular = materials[3 * material + 2].rgb;
+    gl_Position = viewProjection * worldPos;
+}
\ No newline at end of file
@@ -1,5 +1,13 @@
 #version 330 core
+#ifdef WEIGHTED_BLENDED_OIT
+// weighted blended order-independent transparency, see oit.fs:
+// rgb: premultiplied color * weight, summed; a: alpha, blended to the product of (1 - alpha)
+layout (location = 0) out vec4 accum;
+// alpha * weight, summed
+layout (location = 1) out float weight;
+#else
 out vec4 FragColor;
+#endif
 
 struct Material {
     vec3 ambient, diffuse, specular;   
@@ -20,8 +28,19 @@ in vec4 FragPosLightSpaces[NUM_LIGHTS];
 uniform float far_plane;
 uniform sampler2D shadowMaps[NUM_LIGHTS];
 uniform vec3 viewPos;
+#ifdef PER_INSTANCE_MATERIAL
+// material of the drawn instance, looked up by indirect.vs
+flat in vec4 MaterialAmbient;   // rgb ambient, a alpha
+flat in vec3 MaterialDiffuse;
+flat in vec3 MaterialSpecular;
+uniform float shininess;
+Material material;
+#else
 uniform Material material;
+#endif
 uniform Light lights[NUM_LIGHTS];
+// lights that shine, the first lightCount of them
+uniform int lightCount;
 uniform bool blinn;
 uniform bool shadows; 
 
@@ -76,11 +95,25 @@ vec3 CalcPointLight(Light light, vec3 norm, vec3 fragPos, vec3 viewDir, vec4 fra
 
 void main()
 {
+#ifdef PER_INSTANCE_MATERIAL
+    material = Material(MaterialAmbient.rgb, MaterialDiffuse, MaterialSpecular, shininess, MaterialAmbient.a);
+#endif
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 result = vec3(0.0);
     for(int i = 0; i < NUM_LIGHTS; i++)
-        result += CalcPointLight(lights[i], norm, FragPos, viewDir, FragPosLightSpaces[i], i); 
+        if (i < lightCount)
+            result += CalcPointLight(lights[i], norm, FragPos, viewDir, FragPosLightSpaces[i], i); 
 
+#ifdef WEIGHTED_BLENDED_OIT
+    // nearer and more opaque fragments weigh more, by linear view depth
+    // (McGuire and Bavoil, 2013, eq. 7); gl_FragCoord.w is 1 / view depth
+    float a = material.alpha;
+    float z = 1.0 / gl_FragCoord.w;
+    float w = clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+    accum = vec4(result * a * w, a);
+    weight = a * w;
+#else
     FragColor = vec4(result, material.alpha);
+#endif
 } 
\ No newline at end of file
@@ -9,16 +9,30 @@ out vec3 Normal;
 out vec4 FragPosLightSpaces[NUM_LIGHTS];
 
 uniform mat4 model;
+uniform mat4 lightSpaceMatrixs[NUM_LIGHTS];
+#ifdef PER_VERTEX_NORMAL_MATRIX
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceMatrixs[NUM_LIGHTS];
+#else
+// computed once per draw on the CPU
+uniform mat3 normalMatrix;
+uniform mat4 mvp;
+#endif
+
+// the depth prepass (shadow.vs) must produce bit-identical depth
+invariant gl_Position;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
     for(int i=0;i<NUM_LIGHTS;++i){
         FragPosLightSpaces[i] = lightSpaceMatrixs[i] * vec4(FragPos, 1.0);
     }
+#ifdef PER_VERTEX_NORMAL_MATRIX
+    Normal = mat3(transpose(inverse(model))) * aNormal;
     gl_Position = projection * view * vec4(FragPos, 1.0);
+#else
+    Normal = normalMatrix * aNormal;
+    gl_Position = mvp * vec4(aPos, 1.0);
+#endif
 }
\ No newline at end of file
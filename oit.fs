@@ -0,0 +1,20 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// targets of the transparent pass (object.fs with WEIGHTED_BLENDED_OIT)
+uniform sampler2D accum;
+uniform sampler2D weight;
+
+// resolve the weighted average color of the transparent fragments; blended
+// over the opaque image with (SRC_ALPHA, ONE_MINUS_SRC_ALPHA)
+void main()
+{
+    vec4 sum = texture(accum, TexCoords);
+    float revealage = sum.a;
+    if (revealage >= 1.0)
+        discard;
+    vec3 average = sum.rgb / max(texture(weight, TexCoords).r, 1e-5);
+    FragColor = vec4(average, 1.0 - revealage);
+}
\ No newline at end of file
@@ -1,10 +1,13 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+// lightSpaceMatrix * model, computed once per draw on the CPU
+uniform mat4 mvp;
+
+// as the depth prepass its depth must match object.vs exactly
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = mvp * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -3,37 +3,93 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include "shader.h"
 #include "camera.h"
+#include "transform.h"
+#include "scene.h"
+#include "gpu_culling.h"
+#include "occlusion.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "gl_resources.h"
+#include "buffer_arena.h"
+#include "headless.h"
+#include "readback.h"
+#include "batch.h"
+#include "image_writer.h"
+#include "mapped_image.h"
+#include "render_farm.h"
+#include "video_stream.h"
+#include "input_record.h"
+#include "frame_bench.h"
+#include "sweep.h"
 #include <iostream>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 // continuous input
 void processInput(GLFWwindow *window);
+void moveCamera(unsigned int keys);
+void replayInput(GLFWwindow *window, float time);
+void orbitCamera(float time);
 // discrete input
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
-void generateSphere(int nSegments, std::vector<float> &vertices, std::vector<int> &indices);
-void generateCone(int nSegments, std::vector<float> &vertices, std::vector<int> &indices);
-void generateCylinder(int nSegments, std::vector<float> &vertices, std::vector<int> &indices);
-void generatePolyhedron(int nSegments, std::vector<float> &vertices, std::vector<int> &indices);
-void renderObjects(Shader &shader, unsigned int objVAO[], unsigned int planeVAO, int target=-1);
+void generateSphere(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds);
+void generateCone(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds);
+void generateCylinder(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds);
+void generatePolyhedron(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds);
+void buildScene();
+void uploadMesh(Mesh &mesh);
+void bindMeshArenas();
+void updateTransforms(const glm::mat4 *viewProjections, int viewCount);
+void cullScene(const glm::mat4 *viewProjections, int viewCount);
+// render passes, in the order their sort keys put them
+enum RenderPass : uint32_t
+{
+    PASS_SHADOW,
+    PASS_DEPTH_PREPASS,
+    PASS_OPAQUE,
+    PASS_TRANSPARENT,
+    PASS_OUTLINE,
+    PASS_LIGHT_SOURCE
+};
+void drawEntity(Shader &shader, int view, size_t i);
+void queueObjects(RenderPass pass, int view, uint32_t mask, uint32_t exclude);
+void submitQueue(Shader &shader, int view);
+void renderObjects(RenderPass pass, Shader &shader, int view, uint32_t mask, Scene::Handle target=Scene::Handle(), uint32_t exclude=0);
+void animateLights(float time);
+void applyJob(const RenderJob &job);
+bool nextFrame(GLFWwindow *window, unsigned int frame, unsigned int &item);
+unsigned int tileCount();
+glm::mat4 tileProjection(unsigned int tile);
+void storeTile(const FrameReadback::Frame &frame);
+int runFarm(int argc, char **argv);
+int runSweep(int argc, char **argv);
+double timeVertexStage(Shader &shader, const glm::mat4 &projection, const glm::mat4 &view, int iterations);
+void setLightUniforms(Shader &shader, const glm::mat4 *lightSpaceMatrixs);
 
 // settings
 // const unsigned int SCR_WIDTH = 1280;
 // const unsigned int SCR_HEIGHT = 1024;
-const unsigned int SCR_WIDTH = 800;
-const unsigned int SCR_HEIGHT = 600;
+// render target size, fixed at startup (--size)
+unsigned int SCR_WIDTH = 800;
+unsigned int SCR_HEIGHT = 600;
 const int NUM_LIGHTS = 2;
 bool blinn = false;
 
-int global_nSegments[4] = {50, 50, 50, 4};
-int prev_nSegments[4] = {50, 50, 50, 4};
-
-int controlTarget = 0;
+// the entity whose outline is drawn and whose segments the arrow keys change
+Scene::Handle controlTarget;
 
 const GLfloat PI = 3.14159265358979323846f;
 
@@ -55,10 +111,6 @@ glm::vec3 lightPos[NUM_LIGHTS]={
     glm::vec3(3.0f, 3.0f, -4.0f)
 };
 
-std::vector<float> objectVertices[4];
-std::vector<int> objectIndices[4];
-std::vector<float> lightVertices;
-std::vector<int> lightIndices;
 std::vector<float> planeVertices = {
     20.0f, 0.0f, 20.0f, 0.0f, 1.0f, 0.0f,
     20.0f, 0.0f, -20.0f, 0.0f, 1.0f, 0.0f,
@@ -67,82 +119,330 @@ std::vector<float> planeVertices = {
     -20.0f, 0.0f, 20.0f, 0.0f, 1.0f, 0.0f,
     20.0f, 0.0f, 20.0f, 0.0f, 1.0f, 0.0f,
 };
-glm::vec3 materialAmbient[5]={
-    glm::vec3(0.0f,0.1f,0.06f),
-    glm::vec3(0.0f,0.0f,0.0f),
-    glm::vec3(0.0f,0.0f,0.0f),
-    glm::vec3(0.2f,0.0f,0.0f),
-    glm::vec3(0.0f,0.0f,0.0f)
-};
-glm::vec3 materialDiffuse[5]={
-    glm::vec3(0.0f,0.5098f,0.5098f),
-    glm::vec3(0.1f,0.35f,0.1f),
-    glm::vec3(0.5f,0.5f,0.0f),
-    glm::vec3(0.8f,0.0f,0.0f),
-    
-    glm::vec3(0.8f,0.8f,0.8f)
-};
-glm::vec3 materialSpecular[5]={
-    glm::vec3(0.5020f,0.5020f,0.5020f),
-    glm::vec3(0.45f,0.55f,0.45f),
-    glm::vec3(0.6f,0.6f,0.5f),
-    glm::vec3(0.7f,0.6f,0.6f),
-    
-    glm::vec3(0.5f,0.5f,0.5f)
-};
-float objScale = 0.5f;
-glm::vec3 objPosition[5]={
-    glm::vec3(-1.0f, 0.0f, -1.0f),
-    glm::vec3(1.0f, objScale, -1.0f),
-    glm::vec3(-1.0f, 0.0f, 1.0f),
-    glm::vec3(1.0f, 0.0f, 1.0f),
-    
-};
-float materialAlpha[5]={ 1.0f, 1.0f, 1.0f, 0.8f, 1.0f};
-void (*generateObject[4])(int, std::vector<float> &, std::vector<int> &) = {
-    generateCylinder, 
-    generateSphere, 
-    generateCone,
-    generatePolyhedron
-};
 
-int main()
+// scene: shared meshes and materials plus every drawable entity
+Scene scene;
+// entities in number-key order
+std::vector<Scene::Handle> selectable;
+Scene::Handle lightEntities[NUM_LIGHTS];
+// per view (the camera, then each light): 1 where an entity's bounds touch the frustum
+AlignedVector<uint8_t> visibility[1 + NUM_LIGHTS];
+CullStats cullStats[1 + NUM_LIGHTS];
+// segment count forced on every generated mesh (--bench-vertex)
+int benchSegments = 0;
+// culling and submission of the lit and shadow passes on the GPU (--gpu-culling, G toggles)
+std::unique_ptr<GpuCulling> gpuCulling;
+bool useGpuCulling = false;
+// occlusion culling of the camera view (O toggles): two-phase Hi-Z on the GPU
+// path, the software rasterizer otherwise
+bool useOcclusionCulling = true;
+std::unique_ptr<SoftwareOcclusion> softwareOcclusion;
+size_t occludedCount = 0;
+// depth-only prepass so the lighting shader runs once per visible pixel (--depth-prepass, P toggles)
+bool useDepthPrepass = false;
+// sorted draw list of the CPU passes and this frame's state changes
+RenderQueue renderQueue;
+RenderQueue::Stats queueStats, lastQueueStats;
+// binding cache every pass goes through (--validate-gl-state checks it against the context)
+GLState &glState = GLState::instance();
+GLState::Stats lastStateStats;
+// vertex and index data of every mesh, sub-allocated from two arenas and
+// drawn through one vertex array; DEFRAG_BUDGET bytes move per arena and frame
+std::unique_ptr<BufferArena> vertexArena, indexArena;
+unsigned int meshVAO = 0;
+GLuint meshVertexBuffer = 0, meshIndexBuffer = 0;
+const size_t VERTEX_STRIDE = 6 * sizeof(float);
+const size_t DEFRAG_BUDGET = 1 << 20;
+// segment cap of the occluder meshes the software rasterizer draws
+const int OCCLUDER_SEGMENTS = 8;
+// render without a window through a surfaceless EGL context (--headless,
+// HEADLESS builds only): headlessFrames frames HEADLESS_TIMESTEP seconds
+// apart, the last one written to headlessOutput
+bool headless = false;
+unsigned int headlessFrames = 1;
+std::string headlessOutput = "frame.ppm";
+const float HEADLESS_TIMESTEP = 1.0f / 60.0f;
+// every frame written to capturePrefix_NNNNN.captureFormat through the asynchronous readback (--capture)
+std::string capturePrefix;
+std::string captureFormat = "ppm";
+std::unique_ptr<FrameReadback> frameCapture;
+// encodes and writes the captured frames off the render thread
+std::unique_ptr<ImageWriter> imageWriter;
+// every frame streamed to streamPath as Y4M or raw RGB (--stream, --stream-rgb),
+// at the headless frame rate, through a readback ring of its own
+std::string streamPath;
+VideoStream::Format streamFormat = VideoStream::STREAM_Y4M;
+std::unique_ptr<FrameReadback> streamReadback;
+std::unique_ptr<VideoStream> videoStream;
+// jobs of a batch run (--batch), one frame each written to the job's output;
+// each applies its overrides to the state the scene had before the first
+std::vector<RenderJob> batchJobs;
+Camera baseCamera = camera;
+glm::vec3 baseLightPos[NUM_LIGHTS];
+std::vector<Material> baseMaterials;
+std::vector<int> baseSegments;
+// tiled rendering (--tiled): an image of posterWidth x posterHeight rendered
+// one render-target-sized tile per frame, each through its part of the
+// camera frustum, and stored into the mapped output as it is read back
+int posterWidth = 0, posterHeight = 0;
+std::string posterOutput;
+std::unique_ptr<MappedImage> posterImage;
+// multi-process rendering (HEADLESS builds only): --farm n renders the batch
+// or the tiles on n headless worker processes, which run with --worker and
+// send what they render back to the coordinator over workerSocket
+unsigned int farmWorkers = 0;
+std::string workerSocket;
+#ifdef HEADLESS
+std::unique_ptr<FarmWorker> farmWorker;
+#endif
+// input recording (--record) and replay (--replay): a recorded run's events
+// are fed back through the callbacks at a fixed timestep, so every replay
+// renders the same frames; movementKeys holds the MOVE_* keys held down
+std::unique_ptr<InputRecorder> inputRecorder;
+std::unique_ptr<InputReplay> inputReplay;
+enum MovementKey : unsigned int
 {
-    // glfw: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    MOVE_FORWARD = 1,
+    MOVE_BACKWARD = 2,
+    MOVE_LEFT = 4,
+    MOVE_RIGHT = 8
+};
+unsigned int movementKeys = 0;
+// frame benchmark (--bench): benchWarmup frames, then benchFrames measured
+// ones written to benchOutput as CSV or JSON. The camera circles the scene
+// BENCH_ORBIT_SPEED radians per second at the headless timestep unless a
+// replay drives it; sceneInstances (--instances), sceneSegments
+// (--segments), activeLights (--lights) and shadowSize (--shadow-size) set
+// the load, benchLabel names the run in the results
+std::string benchOutput, benchLabel;
+unsigned int benchWarmup = 60, benchFrames = 300;
+std::unique_ptr<FrameBench> frameBench;
+const float BENCH_ORBIT_SPEED = 0.5f;
+int sceneInstances = 4;
+int sceneSegments = 0;
+int activeLights = NUM_LIGHTS;
+unsigned int shadowSize = 4096;
+// scalability sweep (--sweep): one benchmark process per configuration of
+// the grid in sweepGrid (see sweep.h), the table of results in sweepOutput
+std::string sweepGrid, sweepOutput;
+// target of the camera passes: the offscreen framebuffer, whose depth the
+// occlusion culling reads and the transparent pass shares
+unsigned int sceneFBO = 0;
+
+int main(int argc, char **argv)
+{
+    // --bench-vertex [segments]: compare vertex-stage time of per-vertex and per-draw normal matrices
+    // --gpu-culling: start with culling and draw submission on the GPU
+    // --validate-gl-state: report bindings the state cache has wrong
+    // --headless: render without a window, see the options below
+    // --size width height: render target size
+    // --frames n, --output file.ppm: frames to render headless and where the last one goes
+    // --camera x y z yaw pitch: initial camera
+    // --capture prefix: write every frame to prefix_NNNNN.ppm
+    // --format ppm|qoi|png|exr: file format of the captured frames
+    // --batch jobs.txt: render one frame per job of the file (see batch.h) and exit
+    // --tiled width height file.ppm: render an image of any size in tiles of --size and exit
+    // --farm n: render the batch or the tiles on n headless processes
+    // --stream fifo, --stream-rgb fifo: stream every frame as Y4M or raw RGB24 for an encoder
+    // --record file: record the input of the run
+    // --replay file: render a recorded run again at the headless timestep and exit
+    // --bench file.csv|file.json: measure frame times of the scripted scene and exit
+    // --bench-frames warmup measured, --bench-label text: frames and name of the benchmark
+    // --segments n, --lights n: segments of every object, lights that shine and cast shadows (1 to NUM_LIGHTS)
+    // --instances n, --shadow-size n: copies of the primitives, shadow map size
+    // --sweep grid.txt table.csv: benchmark every configuration of the grid (see sweep.h)
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--bench-vertex")
+            benchSegments = (i + 1 < argc) ? std::atoi(argv[++i]) : 512;
+        else if (std::string(argv[i]) == "--gpu-culling")
+            useGpuCulling = true;
+        else if (std::string(argv[i]) == "--depth-prepass")
+            useDepthPrepass = true;
+        else if (std::string(argv[i]) == "--validate-gl-state")
+            glState.validation = true;
+        else if (std::string(argv[i]) == "--headless")
+            headless = true;
+        else if (std::string(argv[i]) == "--size" && i + 2 < argc)
+        {
+            SCR_WIDTH = std::max(1, std::atoi(argv[++i]));
+            SCR_HEIGHT = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::string(argv[i]) == "--frames" && i + 1 < argc)
+            headlessFrames = std::max(1, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--output" && i + 1 < argc)
+            headlessOutput = argv[++i];
+        else if (std::string(argv[i]) == "--capture" && i + 1 < argc)
+            capturePrefix = argv[++i];
+        else if (std::string(argv[i]) == "--format" && i + 1 < argc)
+            captureFormat = argv[++i];
+        else if (std::string(argv[i]) == "--batch" && i + 1 < argc)
+        {
+            if (!loadRenderJobs(argv[++i], batchJobs))
+                return -1;
+        }
+        else if (std::string(argv[i]) == "--tiled" && i + 3 < argc)
+        {
+            posterWidth = std::max(1, std::atoi(argv[++i]));
+            posterHeight = std::max(1, std::atoi(argv[++i]));
+            posterOutput = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--stream" && i + 1 < argc)
+            streamPath = argv[++i];
+        else if (std::string(argv[i]) == "--stream-rgb" && i + 1 < argc)
+        {
+            streamPath = argv[++i];
+            streamFormat = VideoStream::STREAM_RGB;
+        }
+        else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+        {
+            inputRecorder.reset(new InputRecorder(argv[++i]));
+            if (!inputRecorder->valid())
+                return -1;
+        }
+        else if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+        {
+            inputReplay.reset(new InputReplay(argv[++i]));
+            if (!inputReplay->valid())
+                return -1;
+        }
+        else if (std::string(argv[i]) == "--bench" && i + 1 < argc)
+            benchOutput = argv[++i];
+        else if (std::string(argv[i]) == "--bench-frames" && i + 2 < argc)
+        {
+            benchWarmup = (unsigned int)std::max(0, std::atoi(argv[++i]));
+            benchFrames = (unsigned int)std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::string(argv[i]) == "--bench-label" && i + 1 < argc)
+            benchLabel = argv[++i];
+        else if (std::string(argv[i]) == "--segments" && i + 1 < argc)
+            sceneSegments = std::max(3, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--lights" && i + 1 < argc)
+        {
+            // the shaders and shadow maps are built for NUM_LIGHTS
+            activeLights = std::atoi(argv[++i]);
+            if (activeLights < 1 || activeLights > NUM_LIGHTS)
+            {
+                std::cout << "--lights takes 1 to " << NUM_LIGHTS << " lights" << std::endl;
+                return -1;
+            }
+        }
+        else if (std::string(argv[i]) == "--instances" && i + 1 < argc)
+            sceneInstances = std::max(1, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--shadow-size" && i + 1 < argc)
+            shadowSize = (unsigned int)std::max(16, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--sweep" && i + 2 < argc)
+        {
+            sweepGrid = argv[++i];
+            sweepOutput = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--farm" && i + 1 < argc)
+            farmWorkers = std::max(1, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--worker" && i + 1 < argc)
+            workerSocket = argv[++i];
+        else if (std::string(argv[i]) == "--camera" && i + 5 < argc)
+        {
+            glm::vec3 position;
+            for (int c = 0; c < 3; ++c)
+                position[c] = (float)std::atof(argv[++i]);
+            float yaw = (float)std::atof(argv[++i]);
+            float pitch = (float)std::atof(argv[++i]);
+            camera = Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+        }
+    }
+    lastX = SCR_WIDTH / 2.0f;
+    lastY = SCR_HEIGHT / 2.0f;
+    if (posterWidth > 0 && !batchJobs.empty())
+    {
+        std::cout << "--tiled and --batch cannot be combined" << std::endl;
+        return -1;
+    }
+    if (!benchOutput.empty() && (posterWidth > 0 || !batchJobs.empty()))
+    {
+        std::cout << "--bench cannot be combined with --tiled or --batch" << std::endl;
+        return -1;
+    }
+    if (inputRecorder && inputReplay)
+    {
+        std::cout << "--record and --replay cannot be combined" << std::endl;
+        return -1;
+    }
+    if (!sweepGrid.empty())
+        return runSweep(argc, argv);
+    if (farmWorkers > 0)
+    {
+#ifdef HEADLESS
+        return runFarm(argc, argv);
+#else
+        std::cout << "--farm needs a build with HEADLESS=1" << std::endl;
+        return -1;
 #endif
+    }
 
-    // glfw window creation
-    // --------------------
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Local illumination models", NULL, NULL);
-    if (window == NULL)
+    GLFWwindow *window = NULL;
+#ifdef HEADLESS
+    std::unique_ptr<HeadlessContext> headlessContext;
+#endif
+    if (headless)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
+#ifdef HEADLESS
+        headlessContext.reset(new HeadlessContext());
+        if (!headlessContext->valid())
+            return -1;
+        if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::procAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+#else
+        std::cout << "--headless needs a build with HEADLESS=1" << std::endl;
         return -1;
+#endif
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    glfwSetKeyCallback(window, key_callback);
+    else
+    {
+        // glfw: initialize and configure
+        // ------------------------------
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
 
-    // glad: load all OpenGL function pointers
-    // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-    {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        // glfw window creation
+        // --------------------
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Local illumination models", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        // a replay gets its input from the recording only
+        if (!inputReplay)
+        {
+            glfwSetCursorPosCallback(window, mouse_callback);
+            glfwSetScrollCallback(window, scroll_callback);
+            glfwSetMouseButtonCallback(window, mouse_button_callback);
+            glfwSetKeyCallback(window, key_callback);
+        }
+
+        // tell GLFW to capture our mouse
+        if (benchSegments == 0 && !inputReplay)
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+        // glad: load all OpenGL function pointers
+        // ---------------------------------------
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
     }
 
     // configure global opengl state
@@ -154,142 +454,280 @@ int main()
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     // build and compile our shader zprogram
     // ------------------------------------
-    Shader lightingShader("object.vs", "object.fs");
-    Shader lightSourceShader("light.vs", "light.fs");
-    Shader simpleDepthShader("shadow.vs", "shadow.fs");
-    Shader outlineShader("outline.vs", "outline.fs");
-
-    // generate objects
-    for (int i = 0; i < 4; ++i)
+    // every stage is compiled once and mixed into pipelines at bind time
+    ShaderStage objectVertex(GL_VERTEX_SHADER, "object.vs");
+    ShaderStage outlineVertex(GL_VERTEX_SHADER, "outline.vs");
+    ShaderStage lightVertex(GL_VERTEX_SHADER, "light.vs");
+    ShaderStage shadowVertex(GL_VERTEX_SHADER, "shadow.vs");
+    ShaderStage objectFragment(GL_FRAGMENT_SHADER, "object.fs");
+    ShaderStage whiteFragment(GL_FRAGMENT_SHADER, "light.fs");
+    ShaderStage shadowFragment(GL_FRAGMENT_SHADER, "shadow.fs");
+    ShaderStage transparentFragment(GL_FRAGMENT_SHADER, "object.fs", "#define WEIGHTED_BLENDED_OIT\n");
+    ShaderStage compositeVertex(GL_VERTEX_SHADER, "oit.vs");
+    ShaderStage compositeFragment(GL_FRAGMENT_SHADER, "oit.fs");
+
+    Shader lightingShader(objectVertex, objectFragment);
+    Shader lightSourceShader(lightVertex, whiteFragment);
+    Shader simpleDepthShader(shadowVertex, shadowFragment);
+    // the outline shares the light source's plain white fragment stage
+    Shader outlineShader(outlineVertex, whiteFragment);
+    // transparent entities accumulate into the OIT targets, resolved by the composite
+    Shader transparentShader(objectVertex, transparentFragment);
+    Shader compositeShader(compositeVertex, compositeFragment);
+
+    // GPU-driven variants: entities and materials come from storage buffers
+    std::unique_ptr<Shader> indirectLightingShader, indirectDepthShader, indirectTransparentShader;
+    if (GpuCulling::supported())
     {
-        generateObject[i](global_nSegments[i], objectVertices[i], objectIndices[i]);
+        ShaderStage indirectVertex(GL_VERTEX_SHADER, "indirect.vs");
+        ShaderStage instanceFragment(GL_FRAGMENT_SHADER, "object.fs", "#define PER_INSTANCE_MATERIAL\n");
+        ShaderStage instanceTransparentFragment(GL_FRAGMENT_SHADER, "object.fs", "#define PER_INSTANCE_MATERIAL\n#define WEIGHTED_BLENDED_OIT\n");
+        indirectLightingShader.reset(new Shader(indirectVertex, instanceFragment));
+        indirectDepthShader.reset(new Shader(indirectVertex, shadowFragment));
+        indirectTransparentShader.reset(new Shader(indirectVertex, instanceTransparentFragment));
+        gpuCulling.reset(new GpuCulling());
     }
-
-    // generate sphere light source 
-    generateSphere(50, lightVertices, lightIndices);
-
-    unsigned int objVAO[4], objVBO[4], objEBO[4];
-    glGenVertexArrays(4, objVAO);
-    glGenBuffers(4, objVBO);
-    glGenBuffers(4, objEBO);
-
-    for (int i = 0; i < 4; ++i)
+    else if (useGpuCulling)
     {
-        glBindVertexArray(objVAO[i]);
-
-        glBindBuffer(GL_ARRAY_BUFFER, objVBO[i]);
-        glBufferData(GL_ARRAY_BUFFER, objectVertices[i].size() * sizeof(float), &objectVertices[i][0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objEBO[i]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, objectIndices[i].size() * sizeof(int), &objectIndices[i][0], GL_STATIC_DRAW);
-
-        // position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-        glEnableVertexAttribArray(0);
-        // normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
+        std::cout << "GPU culling needs OpenGL 4.3, culling on the CPU" << std::endl;
+        useGpuCulling = false;
     }
 
-    unsigned int lightVAO, lightVBO, lightEBO;
-    glGenVertexArrays(1, &lightVAO);
-    glGenBuffers(1, &lightVBO);
-    glGenBuffers(1, &lightEBO);
-
-    glBindVertexArray(lightVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, lightVBO);
-    glBufferData(GL_ARRAY_BUFFER, lightVertices.size() * sizeof(float), &lightVertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lightEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, lightIndices.size() * sizeof(int), &lightIndices[0], GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    unsigned int planeVAO, planeVBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-
-    glBindVertexArray(planeVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, planeVertices.size() * sizeof(float), &planeVertices[0], GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // depth buffer of the software occlusion culling, a quarter of the window on each axis
+    softwareOcclusion.reset(new SoftwareOcclusion(SCR_WIDTH / 4, SCR_HEIGHT / 4));
+
+    // generate objects and upload their meshes
+    vertexArena.reset(new BufferArena(VERTEX_STRIDE, 1 << 16));
+    indexArena.reset(new BufferArena(sizeof(int), 1 << 18));
+    meshVAO = createVertexArray();
+    buildScene();
+    for (Mesh &mesh : scene.meshes)
+        uploadMesh(mesh);
+    // what every batch job starts from
+    baseCamera = camera;
+    std::copy(lightPos, lightPos + NUM_LIGHTS, baseLightPos);
+    baseMaterials = scene.materials;
+    for (const Mesh &mesh : scene.meshes)
+        baseSegments.push_back(mesh.nSegments);
 
     // configure depth map FBO
     // -----------------------
-    const unsigned int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
+    const unsigned int SHADOW_WIDTH = shadowSize, SHADOW_HEIGHT = shadowSize;
     unsigned int depthMapFBO[NUM_LIGHTS];
-    glGenFramebuffers(NUM_LIGHTS, depthMapFBO);
-    // create depth texture
     unsigned int depthMap[NUM_LIGHTS];
-    glGenTextures(NUM_LIGHTS, depthMap);
+    const GLenum noColor = GL_NONE;
     for(int i=0;i<NUM_LIGHTS;++i){
-        glBindTexture(GL_TEXTURE_2D, depthMap[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        // create depth texture
+        depthMap[i] = createTexture2D(GL_DEPTH_COMPONENT24, SHADOW_WIDTH, SHADOW_HEIGHT);
         GLfloat borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        setTextureWrap(depthMap[i], GL_CLAMP_TO_BORDER, borderColor);
         // attach depth texture as FBO's depth buffer
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap[i], 0);
-        glDrawBuffer(GL_NONE);
-        glReadBuffer(GL_NONE);
+        depthMapFBO[i] = createFramebuffer();
+        attachTexture(depthMapFBO[i], GL_DEPTH_ATTACHMENT, depthMap[i]);
+        setDrawBuffers(depthMapFBO[i], 1, &noColor);
     }
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    lightingShader.use();
-    for(int i=0;i<NUM_LIGHTS;++i){
-        lightingShader.setInt("shadowMaps["+std::to_string(i)+"]", i);
+    // offscreen camera target, blitted to the window at the end of the frame;
+    // its depth is readable by the occlusion culling
+    unsigned int offscreenColor = createRenderbuffer(GL_RGBA8, SCR_WIDTH, SCR_HEIGHT);
+    unsigned int offscreenDepth = createTexture2D(GL_DEPTH_COMPONENT32F, SCR_WIDTH, SCR_HEIGHT);
+    unsigned int offscreenFBO = createFramebuffer();
+    attachRenderbuffer(offscreenFBO, GL_COLOR_ATTACHMENT0, offscreenColor);
+    attachTexture(offscreenFBO, GL_DEPTH_ATTACHMENT, offscreenDepth);
+    if (!framebufferComplete(offscreenFBO))
+        std::cout << "ERROR::FRAMEBUFFER:: Offscreen framebuffer is not complete!" << std::endl;
+    sceneFBO = offscreenFBO;
+
+    // weighted blended OIT targets, depth-tested against the opaque depth;
+    // 32-bit floats, as a few dozen near layers of weighted color already
+    // add up past the 65504 of a 16-bit float
+    unsigned int oitFBO = createFramebuffer(), oitTextures[2];
+    GLenum oitFormats[2] = {GL_RGBA32F, GL_R32F};
+    GLenum oitBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    for (int i = 0; i < 2; ++i)
+    {
+        oitTextures[i] = createTexture2D(oitFormats[i], SCR_WIDTH, SCR_HEIGHT);
+        attachTexture(oitFBO, oitBuffers[i], oitTextures[i]);
+    }
+    attachTexture(oitFBO, GL_DEPTH_ATTACHMENT, offscreenDepth);
+    setDrawBuffers(oitFBO, 2, oitBuffers);
+    if (!framebufferComplete(oitFBO))
+        std::cout << "ERROR::FRAMEBUFFER:: OIT framebuffer is not complete!" << std::endl;
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the composite triangle has no vertex data, but core profile needs a VAO bound
+    unsigned int emptyVAO = createVertexArray();
+
+    // a farm worker sends every frame back to the coordinator; otherwise tiles
+    // go into the mapped image, and for files the consumer only copies the
+    // frame and the writer's threads encode it
+    if (!workerSocket.empty())
+    {
+#ifdef HEADLESS
+        farmWorker.reset(new FarmWorker(workerSocket));
+        if (!farmWorker->valid())
+            return -1;
+        frameCapture.reset(new FrameReadback(SCR_WIDTH, SCR_HEIGHT, [](const FrameReadback::Frame &frame) {
+            farmWorker->sendResult((unsigned int)frame.item, frame.width, frame.height, frame.rgba);
+        }));
+        frameCapture->failed = [](const FrameReadback::Frame &frame) {
+            farmWorker->sendFailure((unsigned int)frame.item);
+        };
+#endif
+    }
+    else if (posterWidth > 0)
+    {
+        posterImage.reset(new MappedImage(posterOutput, posterWidth, posterHeight));
+        if (!posterImage->valid())
+            return -1;
+        frameCapture.reset(new FrameReadback(SCR_WIDTH, SCR_HEIGHT, storeTile));
+    }
+    else if (!capturePrefix.empty() || !batchJobs.empty())
+    {
+        imageWriter.reset(new ImageWriter());
+        frameCapture.reset(new FrameReadback(SCR_WIDTH, SCR_HEIGHT, [](const FrameReadback::Frame &frame) {
+            std::string number = std::to_string(frame.index);
+            std::string path = !batchJobs.empty() ? batchJobs[frame.item].output
+                                                  : capturePrefix + "_" + std::string(number.size() < 5 ? 5 - number.size() : 0, '0') + number + "." + captureFormat;
+            imageWriter->write(path, frame.width, frame.height, frame.rgba);
+        }));
+    }
+
+    // the stream's thread converts straight from the mapped pixel buffers
+    if (!streamPath.empty())
+    {
+        videoStream.reset(new VideoStream(streamPath, SCR_WIDTH, SCR_HEIGHT, (int)std::lround(1.0f / HEADLESS_TIMESTEP), streamFormat));
+        if (!videoStream->valid())
+            return -1;
+        streamReadback.reset(new FrameReadback(SCR_WIDTH, SCR_HEIGHT, [](const FrameReadback::Frame &frame) {
+            videoStream->submit(frame, *streamReadback);
+        }, FrameReadback::DEFAULT_RING_SIZE + 1));
+        streamReadback->holdFrames = true;
+    }
+
+    Shader *litShaders[] = {&lightingShader, &transparentShader, indirectLightingShader.get(), indirectTransparentShader.get()};
+    for (Shader *shader : litShaders)
+    {
+        if (!shader)
+            continue;
+        shader->use();
+        for (int i = 0; i < NUM_LIGHTS; ++i)
+            shader->setInt("shadowMaps[" + std::to_string(i) + "]", i);
     }
+    compositeShader.use();
+    compositeShader.setInt("accum", 0);
+    compositeShader.setInt("weight", 1);
+
+    if (benchSegments > 0)
+    {
+        // the previous object.vs, inverting the model matrix for every vertex
+        ShaderStage legacyVertex(GL_VERTEX_SHADER, "object.vs", "#define PER_VERTEX_NORMAL_MATRIX\n");
+        Shader legacyShader(legacyVertex, objectFragment);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+        const int iterations = 200;
+        // unique vertices, and the indices that reference them
+        size_t vertices = 0, indices = 0;
+        for (size_t i = 0; i < scene.size(); ++i)
+        {
+            if (scene.flags[i] & SCENE_LIT)
+            {
+                vertices += scene.meshes[scene.mesh[i]].vertices.size() * sizeof(float) / VERTEX_STRIDE;
+                indices += scene.meshes[scene.mesh[i]].indices.size();
+            }
+        }
+
+        double legacyTime = timeVertexStage(legacyShader, projection, view, iterations);
+        double currentTime = timeVertexStage(lightingShader, projection, view, iterations);
+        std::cout << "vertex stage, " << benchSegments << " segments, " << vertices << " vertices (" << indices << " indices) per pass" << std::endl;
+        std::cout << "  per-vertex normal matrix: " << legacyTime << " ms" << std::endl;
+        std::cout << "  per-draw normal matrix:   " << currentTime << " ms (" << legacyTime / currentTime << "x)" << std::endl;
+        if (window)
+            glfwTerminate();
+        return 0;
+    }
+
+    if (!benchOutput.empty())
+    {
+        frameBench.reset(new FrameBench(benchWarmup, benchFrames));
+        // presenting is not measured, and must not wait for the display either
+        if (window)
+            glfwSwapInterval(0);
+    }
+
+    // fragments the opaque lighting pass shades; results are read two frames
+    // later, by when the GPU has normally finished them
+    unsigned int shadedQueries[2];
+    glGenQueries(2, shadedQueries);
+    GLuint64 shadedSamples = 0;
+    unsigned int frameIndex = 0;
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    float lastReport = 0.0f;
+    std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+    // what the frame shows: a job or tile number, the frame's own elsewhere
+    unsigned int item = 0;
+    for (; nextFrame(window, frameIndex, item); ++frameIndex)
     {
-        // per-frame time logic
+        if (frameBench)
+            frameBench->beginFrame();
+        // per-frame time logic; headless, replayed and benchmark frames are a
+        // fixed step apart, batch frames at their job's time, and all tiles
+        // show the same moment
         // --------------------
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
+        float currentFrame = window ? static_cast<float>(glfwGetTime()) : frameIndex * HEADLESS_TIMESTEP;
+        if (inputReplay)
+            currentFrame = inputReplay->startTime() + frameIndex * HEADLESS_TIMESTEP;
+        else if (frameBench)
+            currentFrame = frameIndex * HEADLESS_TIMESTEP;
+        if (!batchJobs.empty())
+            currentFrame = batchJobs[item].time;
+        else if (posterWidth > 0)
+            currentFrame = 0.0f;
+        deltaTime = frameIndex == 0 && inputReplay ? 0.0f : currentFrame - lastFrame;
         lastFrame = currentFrame;
-        lightPos[NUM_LIGHTS-1].x = 5.0f * cos(glfwGetTime());
-        lightPos[NUM_LIGHTS-1].z = 5.0f * sin(glfwGetTime());
-        // input
+        if (inputRecorder && frameIndex == 0)
+        {
+            InputEvent start;
+            start.type = InputEvent::START;
+            start.time = currentFrame;
+            inputRecorder->record(start);
+        }
+        // input, or the job's changes in a batch
         // -----
-        processInput(window);
+        if (!batchJobs.empty())
+            applyJob(batchJobs[item]);
+        else
+        {
+            animateLights(currentFrame);
+            if (inputReplay)
+                replayInput(window, currentFrame);
+            else if (frameBench)
+                orbitCamera(currentFrame);
+            else if (window && posterWidth == 0)
+                processInput(window);
+        }
         // render
         // ------
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // process segment changes
-        if (prev_nSegments[controlTarget] != global_nSegments[controlTarget])
+        for (Mesh &mesh : scene.meshes)
         {
-            prev_nSegments[controlTarget] = global_nSegments[controlTarget];
-
-            generateObject[controlTarget](global_nSegments[controlTarget], objectVertices[controlTarget], objectIndices[controlTarget]);
-
-            glBindVertexArray(objVAO[controlTarget]);
-
-            glBindBuffer(GL_ARRAY_BUFFER, objVBO[controlTarget]);
-            glBufferData(GL_ARRAY_BUFFER, objectVertices[controlTarget].size() * sizeof(float), &objectVertices[controlTarget][0], GL_STATIC_DRAW);
-
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objEBO[controlTarget]);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, objectIndices[controlTarget].size() * sizeof(int), &objectIndices[controlTarget][0], GL_STATIC_DRAW);
+            if (mesh.generate && mesh.builtSegments != mesh.nSegments)
+                uploadMesh(mesh);
         }
-
-        // 1. render depth of scene to texture (from light's perspective)
-        // --------------------------------------------------------------
+        // close the holes regenerated meshes left, a little each frame
+        vertexArena->defragment(DEFRAG_BUDGET);
+        indexArena->defragment(DEFRAG_BUDGET);
+
+        // view/projection transformations: the camera first, then one per light
+        glm::mat4 viewProjections[1 + NUM_LIGHTS];
+        glm::mat4 projection = posterWidth > 0 ? tileProjection(item)
+                                           : glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+        viewProjections[0] = projection * view;
         glm::mat4 lightProjection, lightView;
         glm::mat4 lightSpaceMatrixs[NUM_LIGHTS];
         float near_plane = 1.0f, far_plane = 25.0f;
@@ -297,94 +735,660 @@ int main()
         for(int i=0;i<NUM_LIGHTS;++i){
             lightView = glm::lookAt(lightPos[i], glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
             lightSpaceMatrixs[i] = lightProjection * lightView;
+            viewProjections[1 + i] = lightSpaceMatrixs[i];
+        }
+        // every pass below reads the matrices and visibility computed here;
+        // only the lights in use (--lights) get views
+        updateTransforms(viewProjections, 1 + activeLights);
+        bool gpuPath = gpuCulling && useGpuCulling;
+        // GPU views: opaque lit entities, the shadow casters of each light,
+        // then the transparent ones, which must not occlude
+        const int transparentView = 1 + activeLights;
+        if (gpuPath)
+        {
+            GpuCulling::View views[2 + NUM_LIGHTS];
+            views[0] = {viewProjections[0], SCENE_LIT, SCENE_TRANSPARENT};
+            for (int i = 0; i < activeLights; ++i)
+                views[1 + i] = {viewProjections[1 + i], SCENE_CASTS_SHADOW, 0};
+            views[transparentView] = {viewProjections[0], SCENE_TRANSPARENT, SCENE_EMISSIVE};
+            gpuCulling->upload(scene);
+            gpuCulling->cull(views, 2 + activeLights, useOcclusionCulling);
+            // the outline and light sources are still drawn one by one
+            visibility[0].assign(scene.size(), 1);
+        }
+        else
+        {
+            cullScene(viewProjections, 1 + activeLights);
+            // rasterize the occluders while the shadow passes are submitted
+            if (useOcclusionCulling)
+                softwareOcclusion->begin(scene, viewProjections[0], 0, visibility[0].data());
+        }
+
+        // report the culling results of each pass twice a second
+        if (window && glfwGetTime() - lastReport > 0.5)
+        {
+            lastReport = static_cast<float>(glfwGetTime());
+            std::string title = "Local illumination models - visible: camera " + std::to_string(cullStats[0].visible) + "/" + std::to_string(cullStats[0].tested);
+            for (int i = 0; i < activeLights; ++i)
+                title += ", light " + std::to_string(i) + " " + std::to_string(cullStats[1 + i].visible) + "/" + std::to_string(cullStats[1 + i].tested);
+            if (!gpuPath && useOcclusionCulling)
+                title += ", occluded " + std::to_string(occludedCount);
+            if (gpuPath)
+                title = std::string("Local illumination models - culling on the GPU") + (useOcclusionCulling ? ", occlusion on" : "");
+            // state changes the render queue elided last frame
+            title += ", binds skipped " + std::to_string(lastQueueStats.skipped()) + "/" + std::to_string(lastQueueStats.skipped() + lastQueueStats.issued());
+            // GL calls the state cache dropped last frame
+            title += ", GL calls skipped " + std::to_string(lastStateStats.skipped) + "/" + std::to_string(lastStateStats.skipped + lastStateStats.issued);
+            // overdraw: shaded fragments per window pixel
+            title += ", shaded/pixel " + std::to_string((double)shadedSamples / (SCR_WIDTH * SCR_HEIGHT)).substr(0, 4);
+            title += useDepthPrepass ? " (prepass)" : "";
+            // mesh memory: share in use and share of the free space fragmented
+            BufferArena::Stats vertexStats = vertexArena->stats(), indexStats = indexArena->stats();
+            title += ", mesh arenas " + std::to_string((int)(100 * vertexStats.occupancy())) + "%/" + std::to_string((int)(100 * indexStats.occupancy())) + "% used";
+            title += " " + std::to_string((int)(100 * vertexStats.fragmentation())) + "%/" + std::to_string((int)(100 * indexStats.fragmentation())) + "% fragmented";
+            if (frameCapture)
+            {
+                const FrameReadback::Stats &captureStats = frameCapture->statistics();
+                title += ", captured " + std::to_string(captureStats.delivered) + " (" + std::to_string(captureStats.stalls) + " stalls)";
+            }
+            if (!batchJobs.empty())
+                title += ", job " + std::to_string(item + 1) + "/" + std::to_string(batchJobs.size());
+            if (posterWidth > 0)
+                title += ", tile " + std::to_string(item + 1) + "/" + std::to_string(tileCount());
+            glfwSetWindowTitle(window, title.c_str());
+        }
+
+        lastQueueStats = queueStats;
+        queueStats = RenderQueue::Stats();
+        lastStateStats = glState.takeStats();
+
+        // 1. render depth of scene to texture (from light's perspective); the
+        // lights do not move between tiles, so the first tile's maps serve all
+        // --------------------------------------------------------------
+        for(int i=0;i<activeLights && !(posterWidth > 0 && frameIndex > 0);++i){
             // render scene from light's point of view
-            simpleDepthShader.use();
-            simpleDepthShader.setMat4("lightSpaceMatrix", lightSpaceMatrixs[i]);
             glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO[i]);
+            glState.bindFramebuffer(GL_FRAMEBUFFER, depthMapFBO[i]);
             glClear(GL_DEPTH_BUFFER_BIT);
 
             // render objects
-            renderObjects(simpleDepthShader, objVAO, planeVAO);
+            if (gpuPath)
+            {
+                indirectDepthShader->use();
+                indirectDepthShader->setMat4("viewProjection", lightSpaceMatrixs[i]);
+                gpuCulling->draw(*indirectDepthShader, 1 + i);
+            }
+            else
+                renderObjects(PASS_SHADOW, simpleDepthShader, 1 + i, SCENE_CASTS_SHADOW);
+        }
 
-            // reset viewport
-            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // the camera passes need the occlusion results
+        if (!gpuPath && useOcclusionCulling)
+        {
+            occludedCount = softwareOcclusion->finish();
+            cullStats[0].visible -= occludedCount;
         }
 
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        glState.bindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        lightingShader.use();
-        for(int i=0;i<NUM_LIGHTS;++i){
-            lightingShader.setMat4("lightSpaceMatrixs["+std::to_string(i)+"]", lightSpaceMatrixs[i]);
-            glActiveTexture(GL_TEXTURE0+i);
-            glBindTexture(GL_TEXTURE_2D, depthMap[i]);
-            // light properties
-            lightingShader.setVec3("lights["+std::to_string(i)+"].position", lightPos[i]);
-            lightingShader.setVec3("lights["+std::to_string(i)+"].ambient", 0.2f, 0.2f, 0.2f);
-            lightingShader.setVec3("lights["+std::to_string(i)+"].diffuse", 0.8f, 0.8f, 0.8f);
-            lightingShader.setVec3("lights["+std::to_string(i)+"].specular", 1.0f, 1.0f, 1.0f);
-            lightingShader.setFloat("lights["+std::to_string(i)+"].constant", 1.0f);
-            lightingShader.setFloat("lights["+std::to_string(i)+"].linear", 0.09f);
-            lightingShader.setFloat("lights["+std::to_string(i)+"].quadratic", 0.032f);
-        }
-        
-        lightingShader.setVec3("viewPos", camera.Position);
-        lightingShader.setFloat("material.shininess", 32.0f);
-        lightingShader.setBool("blinn", blinn);
-        
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-        outlineShader.use();
-        outlineShader.setMat4("projection", projection);
-        outlineShader.setMat4("view", view);
-
-        // render the plane and objects
-        renderObjects(lightingShader, objVAO, planeVAO);    
+        for(int i=0;i<NUM_LIGHTS;++i)
+            glState.bindTextureUnit(i, depthMap[i]);
+        Shader &litShader = gpuPath ? *indirectLightingShader : lightingShader;
+        Shader &blendShader = gpuPath ? *indirectTransparentShader : transparentShader;
+        setLightUniforms(litShader, lightSpaceMatrixs);
+        setLightUniforms(blendShader, lightSpaceMatrixs);
+
+        // render the plane and objects: the opaque ones, optionally after a
+        // depth-only prepass so only the nearest fragment is shaded, then the
+        // transparent ones
+        if (gpuPath)
+        {
+            litShader.setMat4("viewProjection", viewProjections[0]);
+            blendShader.setMat4("viewProjection", viewProjections[0]);
+        }
+        if (useDepthPrepass)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (gpuPath)
+            {
+                indirectDepthShader->use();
+                indirectDepthShader->setMat4("viewProjection", viewProjections[0]);
+                gpuCulling->draw(*indirectDepthShader, 0);
+                gpuCulling->cullOccluded(offscreenDepth, SCR_WIDTH, SCR_HEIGHT);
+                gpuCulling->draw(*indirectDepthShader, gpuCulling->lateView());
+            }
+            else
+                renderObjects(PASS_DEPTH_PREPASS, simpleDepthShader, 0, SCENE_LIT, Scene::Handle(), SCENE_TRANSPARENT);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        unsigned int shadedQuery = shadedQueries[frameIndex % 2];
+        if (frameIndex >= 2)
+            glGetQueryObjectui64v(shadedQuery, GL_QUERY_RESULT, &shadedSamples);
+        glBeginQuery(GL_SAMPLES_PASSED, shadedQuery);
+        if (gpuPath)
+        {
+            gpuCulling->draw(litShader, 0);
+            // entities the previous frame's depth hid, tested again against this frame's
+            if (!useDepthPrepass)
+                gpuCulling->cullOccluded(offscreenDepth, SCR_WIDTH, SCR_HEIGHT);
+            gpuCulling->draw(litShader, gpuCulling->lateView());
+        }
+        else
+            renderObjects(PASS_OPAQUE, lightingShader, 0, SCENE_LIT, Scene::Handle(), SCENE_TRANSPARENT);
+        glEndQuery(GL_SAMPLES_PASSED);
+        glDepthFunc(GL_LESS);
+
+        // transparent entities in any order: weighted color and revealage
+        // accumulate in the OIT targets, tested against the opaque depth
+        glState.bindFramebuffer(GL_FRAMEBUFFER, oitFBO);
+        const GLfloat clearAccum[] = {0.0f, 0.0f, 0.0f, 1.0f}, clearWeight[] = {0.0f, 0.0f, 0.0f, 0.0f};
+        glClearBufferfv(GL_COLOR, 0, clearAccum);
+        glClearBufferfv(GL_COLOR, 1, clearWeight);
+        glDepthMask(GL_FALSE);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+        if (gpuPath)
+            gpuCulling->draw(blendShader, transparentView);
+        else
+        {
+            queueObjects(PASS_TRANSPARENT, 0, SCENE_TRANSPARENT, 0);
+            submitQueue(blendShader, 0);
+        }
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        // resolve over the opaque image
+        glState.bindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glDisable(GL_DEPTH_TEST);
+        compositeShader.use();
+        glState.bindTextureUnit(0, oitTextures[0]);
+        glState.bindTextureUnit(1, oitTextures[1]);
+        glState.bindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
 
         // render select outlines
         glCullFace(GL_FRONT);
-        renderObjects(outlineShader, objVAO, planeVAO, controlTarget);
+        renderObjects(PASS_OUTLINE, outlineShader, 0, SCENE_SELECTABLE, controlTarget);
         glCullFace(GL_BACK);
 
         // also draw the light source object
-        lightSourceShader.use();
-        lightSourceShader.setMat4("projection", projection);
-        lightSourceShader.setMat4("view", view);
-        for(int i=0;i<NUM_LIGHTS;++i){
-            glm::mat4 lightModel = glm::mat4(1.0f);
-            lightModel = glm::translate(lightModel, lightPos[i]);
-            lightModel = glm::scale(lightModel, glm::vec3(0.2f));
-            lightSourceShader.setMat4("model", lightModel);
-
-            glBindVertexArray(lightVAO);
-            glDrawElements(GL_TRIANGLES, lightIndices.size(), GL_UNSIGNED_INT, 0);
+        renderObjects(PASS_LIGHT_SOURCE, lightSourceShader, 0, SCENE_EMISSIVE);
+        // queue this frame's readback and write out the ones finished since
+        if (frameCapture)
+        {
+            frameCapture->capture(sceneFBO, item);
+            frameCapture->poll();
         }
+        if (streamReadback)
+        {
+            streamReadback->capture(sceneFBO, item);
+            streamReadback->poll();
+        }
+        if (frameBench)
+        {
+            frameBench->endFrame((unsigned int)queueStats.draws + (gpuCulling ? (unsigned int)gpuCulling->drawCalls : 0));
+            if (gpuCulling)
+                gpuCulling->drawCalls = 0;
+        }
+        if (!window)
+            continue;
+        glState.bindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glState.bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------   
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    if (inputRecorder)
+    {
+        InputEvent end;
+        end.type = InputEvent::END;
+        end.time = lastFrame;
+        inputRecorder->record(end);
+        inputRecorder.reset();
+    }
+    if (inputReplay)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+        std::cout << frameIndex << " frames replayed in " << seconds << " s, " << 1000.0 * seconds / std::max(1u, frameIndex) << " ms/frame" << std::endl;
+    }
+
+    if (frameBench)
+    {
+        frameBench->finish();
+        std::string segments;
+        for (Scene::Handle handle : selectable)
+            segments += (segments.empty() ? "" : " ") + std::to_string(scene.meshes[scene.mesh[scene.indexOf(handle)]].nSegments);
+        size_t triangles = 0;
+        for (size_t i = 0; i < scene.size(); ++i)
+        {
+            if (scene.flags[i] & SCENE_LIT)
+                triangles += scene.meshes[scene.mesh[i]].indices.size() / 3;
+        }
+        FrameBench::Settings settings = {
+            {"label", benchLabel},
+            {"renderer", (const char *)glGetString(GL_RENDERER)},
+            {"version", (const char *)glGetString(GL_VERSION)},
+            {"size", std::to_string(SCR_WIDTH) + "x" + std::to_string(SCR_HEIGHT)},
+            {"instances", std::to_string(sceneInstances)},
+            {"segments", segments},
+            {"triangles", std::to_string(triangles)},
+            {"lights", std::to_string(activeLights)},
+            {"shadow", std::to_string(shadowSize)},
+            {"culling", gpuCulling && useGpuCulling ? "gpu" : useOcclusionCulling ? "cpu+occlusion" : "cpu"},
+            {"prepass", useDepthPrepass ? "on" : "off"},
+            {"warmup", std::to_string(benchWarmup)},
+            {"frames", std::to_string(frameBench->results().size())}};
+        std::cout << frameBench->results().size() << " frames measured after " << benchWarmup << " warm-up frames" << std::endl;
+        std::cout << "  cpu ms: " << FrameBench::toText(frameBench->cpuSummary()) << std::endl;
+        std::cout << "  gpu ms: " << FrameBench::toText(frameBench->gpuSummary()) << std::endl;
+        std::cout << "  draws:  " << FrameBench::toText(frameBench->drawSummary()) << std::endl;
+        if (frameBench->write(benchOutput, settings))
+            std::cout << benchOutput << " written" << std::endl;
+        frameBench.reset();
+    }
+
+    // headless: the last frame is the output
+    if (!window && batchJobs.empty() && posterWidth == 0 && benchOutput.empty())
+    {
+        std::vector<unsigned char> pixels((size_t)SCR_WIDTH * SCR_HEIGHT * 4);
+        glState.bindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        if (writeImage(headlessOutput, SCR_WIDTH, SCR_HEIGHT, pixels.data()))
+            std::cout << frameIndex << " frames rendered, " << headlessOutput << " written" << std::endl;
+        else
+            std::cout << "ERROR::OUTPUT:: Failed to write " << headlessOutput << std::endl;
+    }
+
+    if (frameCapture)
+    {
+        frameCapture->flush();
+        if (imageWriter)
+            imageWriter->finish();
+        const FrameReadback::Stats &captureStats = frameCapture->statistics();
+        std::cout << captureStats.delivered << " frames captured, " << captureStats.stalls << " stalls, "
+                  << captureStats.stallMilliseconds << " ms waited" << std::endl;
+        if (imageWriter)
+        {
+            ImageWriter::Stats writerStats = imageWriter->statistics();
+            std::cout << writerStats.written << " images written (" << writerStats.bytes / (1024 * 1024) << " MiB, "
+                      << writerStats.failed << " failed), " << writerStats.blocked << " waits for a free buffer, "
+                      << writerStats.blockedMilliseconds << " ms" << std::endl;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+        if (!batchJobs.empty())
+            std::cout << frameIndex << " jobs in " << seconds << " s, " << frameIndex / seconds << " jobs/s" << std::endl;
+        if (posterImage)
+            std::cout << posterOutput << ": " << posterWidth << "x" << posterHeight << " in " << frameIndex << " tiles, "
+                      << seconds << " s, " << (double)posterWidth * posterHeight / seconds / 1.0e6 << " Mpixel/s" << std::endl;
+        frameCapture.reset();
+        imageWriter.reset();
+        posterImage.reset();
+    }
+
+    if (streamReadback)
+    {
+        streamReadback->flush();
+        videoStream->finish();
+        VideoStream::Stats streamStats = videoStream->statistics();
+        std::cout << streamStats.frames << " frames streamed, " << streamStats.dropped << " dropped; "
+                  << streamStats.convertMilliseconds / std::max<uint64_t>(1, streamStats.frames + streamStats.dropped) << " ms converting and "
+                  << streamStats.writeMilliseconds / std::max<uint64_t>(1, streamStats.frames + streamStats.dropped) << " ms writing per frame, "
+                  << streamReadback->statistics().stalls << " capture stalls" << std::endl;
+        // the stream's thread is done with the ring before it goes
+        videoStream.reset();
+        streamReadback.reset();
+    }
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(4, objVAO);
-    glDeleteVertexArrays(1, &lightVAO);
-    glDeleteVertexArrays(1, &planeVAO);
-    glDeleteBuffers(4, objVBO);
-    glDeleteBuffers(4, objEBO);
-    glDeleteBuffers(1, &lightVBO);
-    glDeleteBuffers(1, &lightEBO);
-    glDeleteBuffers(1, &planeVBO);
-    glDeleteFramebuffers(NUM_LIGHTS, depthMapFBO);
-    glDeleteTextures(NUM_LIGHTS, depthMap);
+    glState.deleteVertexArrays(1, &meshVAO);
+    vertexArena.reset();
+    indexArena.reset();
+    glState.deleteFramebuffers(NUM_LIGHTS, depthMapFBO);
+    glState.deleteTextures(NUM_LIGHTS, depthMap);
+    glState.deleteFramebuffers(1, &offscreenFBO);
+    glDeleteRenderbuffers(1, &offscreenColor);
+    glState.deleteTextures(1, &offscreenDepth);
+    glState.deleteFramebuffers(1, &oitFBO);
+    glState.deleteTextures(2, oitTextures);
+    glState.deleteVertexArrays(1, &emptyVAO);
+    glDeleteQueries(2, shadedQueries);
+    gpuCulling.reset();
+    softwareOcclusion.reset();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
-    glfwTerminate();
+    if (window)
+        glfwTerminate();
+    return 0;
+}
+
+// the animated light circles the scene once every 2 pi seconds
+void animateLights(float time)
+{
+    lightPos[NUM_LIGHTS-1].x = 5.0f * cos(time);
+    lightPos[NUM_LIGHTS-1].z = 5.0f * sin(time);
+}
+
+// reset camera, lights, materials and segment counts to the base state, then
+// apply the job's overrides; meshes whose count changed regenerate this frame.
+// An alpha override keeps the object in the pass its creation put it in
+void applyJob(const RenderJob &job)
+{
+    camera = baseCamera;
+    if (job.overrideCamera)
+        camera = Camera(job.cameraPosition, glm::vec3(0.0f, 1.0f, 0.0f), job.yaw, job.pitch);
+    std::copy(baseLightPos, baseLightPos + NUM_LIGHTS, lightPos);
+    animateLights(job.time);
+    for (const RenderJob::LightOverride &light : job.lights)
+    {
+        if (light.light >= 0 && light.light < NUM_LIGHTS)
+            lightPos[light.light] = light.position;
+    }
+
+    for (size_t m = 0; m < scene.meshes.size(); ++m)
+        scene.meshes[m].nSegments = baseSegments[m];
+    for (const RenderJob::SegmentOverride &segments : job.segments)
+    {
+        if (segments.object >= 0 && segments.object < (int)selectable.size() && scene.alive(selectable[segments.object]))
+            scene.meshes[scene.mesh[scene.indexOf(selectable[segments.object])]].nSegments = segments.segments;
+    }
+
+    scene.materials = baseMaterials;
+    for (const RenderJob::MaterialOverride &override : job.materials)
+    {
+        if (override.object < 0 || override.object >= (int)selectable.size() || !scene.alive(selectable[override.object]))
+            continue;
+        Material &material = scene.materials[scene.material[scene.indexOf(selectable[override.object])]];
+        if (override.field == 0)
+            material.ambient = override.value;
+        else if (override.field == 1)
+            material.diffuse = override.value;
+        else if (override.field == 2)
+            material.specular = override.value;
+        else
+            material.alpha = override.value.x;
+    }
+}
+
+// whether the render loop goes on to the given frame, and the item it
+// renders: the next job or tile, or the one the coordinator sends a farm
+// worker. It stops when the window closed, the batch, the tiles, the
+// farm's work, the benchmark or the replay are done, or the headless frames
+// are rendered
+bool nextFrame(GLFWwindow *window, unsigned int frame, unsigned int &item)
+{
+    item = frame;
+#ifdef HEADLESS
+    if (farmWorker)
+    {
+        // the coordinator may be waiting for the frames still in the readback
+        // ring before it sends more
+        if (!farmWorker->ready())
+            frameCapture->flush();
+        unsigned int items = !batchJobs.empty() ? (unsigned int)batchJobs.size() : tileCount();
+        while (farmWorker->next(item))
+        {
+            if (item < items)
+                return true;
+            // not a job or tile of this worker's batch or poster
+            farmWorker->sendFailure(item);
+        }
+        return false;
+    }
+#endif
+    if (window && glfwWindowShouldClose(window))
+        return false;
+    if (!batchJobs.empty())
+        return frame < batchJobs.size();
+    if (posterWidth > 0)
+        return frame < tileCount();
+    if (frameBench)
+        return frame < frameBench->frameCount();
+    if (inputReplay)
+        return frame < inputReplay->frameCount(HEADLESS_TIMESTEP);
+    return window || frame < headlessFrames;
+}
+
+// tiles of the render target's size covering the poster, the last column
+// and row reaching past its edge
+unsigned int tileCount()
+{
+    unsigned int columns = (posterWidth + SCR_WIDTH - 1) / SCR_WIDTH;
+    unsigned int rows = (posterHeight + SCR_HEIGHT - 1) / SCR_HEIGHT;
+    return columns * rows;
+}
+
+// the part of the poster's perspective frustum seen by a tile, row by row
+// from the top left: an off-center frustum on the same near plane, so the
+// tiles' pixels are exactly the poster's
+glm::mat4 tileProjection(unsigned int tile)
+{
+    unsigned int columns = (posterWidth + SCR_WIDTH - 1) / SCR_WIDTH;
+    float x = (float)(tile % columns * SCR_WIDTH), y = (float)(tile / columns * SCR_HEIGHT);
+    const float near_plane = 0.1f, far_plane = 100.0f;
+    float top = near_plane * std::tan(glm::radians(camera.Zoom) / 2.0f);
+    float right = top * posterWidth / posterHeight;
+    return glm::frustum(-right + 2.0f * right * x / posterWidth, -right + 2.0f * right * (x + SCR_WIDTH) / posterWidth,
+                        top - 2.0f * top * (y + SCR_HEIGHT) / posterHeight, top - 2.0f * top * y / posterHeight, near_plane, far_plane);
+}
+
+// copy a read back tile into the poster, dropping what lies past its edge;
+// a finished row of tiles starts going to disk
+void storeTile(const FrameReadback::Frame &frame)
+{
+    unsigned int columns = (posterWidth + SCR_WIDTH - 1) / SCR_WIDTH;
+    int x0 = (int)(frame.item % columns * SCR_WIDTH), y0 = (int)(frame.item / columns * SCR_HEIGHT);
+    int width = std::min(frame.width, posterWidth - x0), height = std::min(frame.height, posterHeight - y0);
+    JobSystem::instance().parallelFor(height, 64, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+        {
+            // frame rows are bottom-up
+            const unsigned char *source = frame.rgba + (size_t)(frame.height - 1 - y) * frame.width * 4;
+            unsigned char *target = posterImage->row(y0 + (int)y) + (size_t)x0 * 3;
+            for (int x = 0; x < width; ++x)
+            {
+                target[x * 3 + 0] = source[x * 4 + 0];
+                target[x * 3 + 1] = source[x * 4 + 1];
+                target[x * 3 + 2] = source[x * 4 + 2];
+            }
+        }
+    });
+    if (frame.item % columns == columns - 1)
+        posterImage->flush(y0, height);
+}
+
+#ifdef HEADLESS
+// coordinate farmWorkers headless copies of this program rendering the batch
+// or the tiles; they get the same arguments, and what they render comes
+// back here to be written out or stored into the mapped image
+int runFarm(int argc, char **argv)
+{
+    if (batchJobs.empty() && posterWidth == 0)
+    {
+        std::cout << "--farm needs --batch or --tiled" << std::endl;
+        return -1;
+    }
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--farm")
+            ++i;
+        else
+            arguments.push_back(argv[i]);
+    }
+    arguments.push_back("--headless");
+
+    unsigned int items = posterWidth > 0 ? tileCount() : (unsigned int)batchJobs.size();
+    if (posterWidth > 0)
+    {
+        posterImage.reset(new MappedImage(posterOutput, posterWidth, posterHeight));
+        if (!posterImage->valid())
+            return -1;
+    }
+    else
+        imageWriter.reset(new ImageWriter());
+    FarmCoordinator farm(items, [](unsigned int item, int width, int height, const unsigned char *rgba) {
+        if (posterImage)
+        {
+            FrameReadback::Frame frame = { item, item, width, height, rgba };
+            storeTile(frame);
+        }
+        else
+            imageWriter->write(batchJobs[item].output, width, height, rgba);
+    });
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool complete = farm.run(farmWorkers, "/proc/self/exe", arguments);
+    imageWriter.reset();
+    posterImage.reset();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const FarmCoordinator::Stats &farmStats = farm.statistics();
+    std::cout << farmStats.completed << "/" << items << " items on " << farmWorkers << " workers in " << seconds << " s, "
+              << farmStats.completed / seconds << " items/s; " << farmStats.stolen << " stolen, " << farmStats.retried << " retried, "
+              << farmStats.failed << " failed, " << farmStats.workersLost << " workers lost" << std::endl;
+    return complete ? 0 : -1;
+}
+#endif
+
+// Scalability sweep: each configuration of the grid is benchmarked by a
+// process of its own, started with this one's arguments plus the
+// configuration's options and --bench. Every run gets a fresh context, and
+// a crash or running out of memory ends only its configuration. A
+// configuration is as fast as the slower of its CPU and GPU sides, which
+// the table names; per axis, with the others at their first value, the
+// report gives the value at which the frame first misses the 60 Hz budget
+// ------------------------------------------------------------------------
+int runSweep(int argc, char **argv)
+{
+    std::vector<SweepAxis> axes;
+    if (!loadSweep(sweepGrid, NUM_LIGHTS, axes))
+        return -1;
+    std::ofstream table(sweepOutput);
+    if (!table)
+    {
+        std::cout << "ERROR::SWEEP:: Failed to create " << sweepOutput << std::endl;
+        return -1;
+    }
+    // the runs' results and output go next to the table
+    std::string runOutput = sweepOutput + ".run.csv", runLog = sweepOutput + ".log";
+    std::vector<std::string> command(1, argv[0]);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--sweep")
+            i += 2;
+        else if (std::string(argv[i]) == "--bench")
+            ++i;
+        else
+            command.push_back(argv[i]);
+    }
+    std::remove(runLog.c_str());
+
+    struct Result
+    {
+        bool complete = false;
+        FrameBench::Summary cpu, gpu;
+        double triangles = 0.0, pixels = 0.0;
+        double frameMilliseconds() const { return std::max(cpu.p50, gpu.p50); }
+        const char *bound() const { return gpu.p50 > cpu.p50 ? "gpu" : "cpu"; }
+    };
+    size_t count = sweepSize(axes);
+    std::vector<Result> results(count);
+    for (const SweepAxis &axis : axes)
+        table << axis.name << ",";
+    table << "triangles,cpu_p50_ms,cpu_p95_ms,gpu_p50_ms,gpu_p95_ms,frame_ms,fps,mtri_per_s,mpixel_per_s,bound\n";
+    for (size_t n = 0; n < count; ++n)
+    {
+        std::vector<size_t> indices = sweepConfiguration(axes, n);
+        std::vector<std::string> options;
+        std::string name;
+        for (size_t a = 0; a < axes.size(); ++a)
+        {
+            sweepOption(axes[a].name, axes[a].values[indices[a]], options);
+            name += (a ? ", " : "") + axes[a].name + " " + axes[a].values[indices[a]];
+        }
+        std::vector<std::string> run = command;
+        run.insert(run.end(), options.begin(), options.end());
+        run.push_back("--bench");
+        run.push_back(runOutput);
+        std::remove(runOutput.c_str());
+        bool exited = runSweepProcess(run, runLog);
+
+        Result &result = results[n];
+        FrameBench::Settings settings;
+        result.complete = exited && FrameBench::readSummary(runOutput, settings, result.cpu, result.gpu);
+        for (const auto &setting : settings)
+        {
+            unsigned int width = 0, height = 0;
+            if (setting.first == "triangles")
+                result.triangles = std::atof(setting.second.c_str());
+            else if (setting.first == "size" && std::sscanf(setting.second.c_str(), "%ux%u", &width, &height) == 2)
+                result.pixels = (double)width * height;
+        }
+        // the table has the values the run reports it measured with, which
+        // the renderer's own limits may have changed from the requested ones;
+        // a setting with a value per object (segments) keeps the requested one
+        for (size_t a = 0; a < axes.size(); ++a)
+        {
+            std::string value = axes[a].values[indices[a]];
+            for (const auto &setting : settings)
+            {
+                if (setting.first == axes[a].name && setting.second.find(' ') == std::string::npos)
+                    value = setting.second;
+            }
+            if (value != axes[a].values[indices[a]])
+                name += " (ran with " + axes[a].name + " " + value + ")";
+            table << value << ",";
+        }
+        std::cout << "[" << n + 1 << "/" << count << "] " << name << ": ";
+        if (!result.complete)
+        {
+            std::cout << "failed, see " << runLog << std::endl;
+            table << ",,,,,,,,,failed\n";
+            continue;
+        }
+        double milliseconds = result.frameMilliseconds();
+        std::cout << milliseconds << " ms (" << result.bound() << " bound)" << std::endl;
+        table << (size_t)result.triangles << "," << result.cpu.p50 << "," << result.cpu.p95 << "," << result.gpu.p50 << "," << result.gpu.p95 << ","
+              << milliseconds << "," << 1000.0 / milliseconds << "," << result.triangles / milliseconds / 1000.0 << ","
+              << result.pixels / milliseconds / 1000.0 << "," << result.bound() << "\n";
+        table.flush();
+    }
+    std::remove(runOutput.c_str());
+
+    // each axis from the first configuration on
+    const double budget = 1000.0 * HEADLESS_TIMESTEP;
+    std::cout << "frame time along each axis, the others at their first value:" << std::endl;
+    for (size_t a = 0; a < axes.size(); ++a)
+    {
+        size_t stride = 1;
+        for (size_t b = a + 1; b < axes.size(); ++b)
+            stride *= axes[b].values.size();
+        std::string limit = "within " + std::to_string(budget).substr(0, 4) + " ms throughout";
+        std::cout << "  " << axes[a].name << ":";
+        for (size_t v = 0; v < axes[a].values.size(); ++v)
+        {
+            const Result &result = results[v * stride];
+            std::cout << " " << axes[a].values[v] << " ";
+            if (!result.complete)
+                std::cout << "failed";
+            else
+                std::cout << result.frameMilliseconds() << " ms";
+            bool over = !result.complete || result.frameMilliseconds() > budget;
+            if (over && limit.compare(0, 6, "within") == 0)
+                limit = "over budget from " + axes[a].values[v] + (result.complete ? std::string(" (") + result.bound() + " bound)" : std::string(" (failed)"));
+        }
+        std::cout << "; " << limit << std::endl;
+    }
+    std::cout << sweepOutput << " written" << std::endl;
     return 0;
 }
 
@@ -392,44 +1396,145 @@ int main()
 // ----------------------------
 void processInput(GLFWwindow *window)
 {
+    unsigned int keys = 0;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        camera.ProcessKeyboard(FORWARD, deltaTime);
+        keys |= MOVE_FORWARD;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        camera.ProcessKeyboard(BACKWARD, deltaTime);
+        keys |= MOVE_BACKWARD;
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        camera.ProcessKeyboard(LEFT, deltaTime);
+        keys |= MOVE_LEFT;
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        keys |= MOVE_RIGHT;
+    // recorded when the held keys change, at the frame's time
+    if (inputRecorder && keys != movementKeys)
+    {
+        InputEvent event;
+        event.type = InputEvent::MOVE;
+        event.time = lastFrame;
+        event.a = (int32_t)keys;
+        inputRecorder->record(event);
+    }
+    movementKeys = keys;
+    moveCamera(keys);
+}
+
+void moveCamera(unsigned int keys)
+{
+    if (keys & MOVE_FORWARD)
+        camera.ProcessKeyboard(FORWARD, deltaTime);
+    if (keys & MOVE_BACKWARD)
+        camera.ProcessKeyboard(BACKWARD, deltaTime);
+    if (keys & MOVE_LEFT)
+        camera.ProcessKeyboard(LEFT, deltaTime);
+    if (keys & MOVE_RIGHT)
         camera.ProcessKeyboard(RIGHT, deltaTime);
 }
 
-// process discrete key event
+// the recorded events up to the frame's time go through the callbacks they
+// came from, then the held keys move the camera by the fixed step
+// ----------------------------------------------------------------
+void replayInput(GLFWwindow *window, float time)
+{
+    InputEvent event;
+    while (inputReplay->next(time, event))
+    {
+        switch (event.type)
+        {
+        case InputEvent::MOVE:
+            movementKeys = (unsigned int)event.a;
+            break;
+        case InputEvent::KEY:
+            key_callback(window, event.a, 0, event.b, event.c);
+            break;
+        case InputEvent::CURSOR:
+            mouse_callback(window, event.x, event.y);
+            break;
+        case InputEvent::SCROLL:
+            scroll_callback(window, 0.0, event.y);
+            break;
+        case InputEvent::BUTTON:
+            mouse_button_callback(window, event.a, event.b, event.c);
+            break;
+        default:
+            break;
+        }
+    }
+    moveCamera(movementKeys);
+}
+
+// the benchmark's camera: around the origin at the start position's distance
+// and height, always looking at the origin
+// ----------------------------------------------------------------
+void orbitCamera(float time)
+{
+    glm::vec3 start = baseCamera.Position;
+    float radius = glm::length(glm::vec2(start.x, start.z));
+    float angle = std::atan2(start.z, start.x) + BENCH_ORBIT_SPEED * time;
+    glm::vec3 position(radius * std::cos(angle), start.y, radius * std::sin(angle));
+    float yaw = glm::degrees(std::atan2(-position.z, -position.x));
+    float pitch = glm::degrees(std::atan2(-position.y, radius));
+    camera = Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+    camera.Zoom = baseCamera.Zoom;
+}
+
+// process discrete key event; window is NULL when a headless replay calls it
 // --------------------------
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+    if (inputRecorder)
+    {
+        InputEvent event;
+        event.type = InputEvent::KEY;
+        event.time = static_cast<float>(glfwGetTime());
+        event.a = key;
+        event.b = action;
+        event.c = mods;
+        inputRecorder->record(event);
+    }
     switch (key)
     {
     case GLFW_KEY_ESCAPE:
-        glfwSetWindowShouldClose(window, true);
+        if (window && !inputReplay)
+            glfwSetWindowShouldClose(window, true);
         break;
     case GLFW_KEY_1:
     case GLFW_KEY_2:
     case GLFW_KEY_3:
     case GLFW_KEY_4:
-        controlTarget = key - GLFW_KEY_1;
+    case GLFW_KEY_5:
+    case GLFW_KEY_6:
+    case GLFW_KEY_7:
+    case GLFW_KEY_8:
+    case GLFW_KEY_9:
+        if (key - GLFW_KEY_1 < (int)selectable.size())
+            controlTarget = selectable[key - GLFW_KEY_1];
         break;
     case GLFW_KEY_B:
         if(action==GLFW_PRESS)
             blinn=!blinn;
         break;
+    case GLFW_KEY_G:
+        if (action == GLFW_PRESS && gpuCulling)
+            useGpuCulling = !useGpuCulling;
+        break;
+    case GLFW_KEY_O:
+        if (action == GLFW_PRESS)
+            useOcclusionCulling = !useOcclusionCulling;
+        break;
+    case GLFW_KEY_P:
+        if (action == GLFW_PRESS)
+            useDepthPrepass = !useDepthPrepass;
+        break;
     case GLFW_KEY_UP:
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-            prev_nSegments[controlTarget] = global_nSegments[controlTarget]++;
+        if (action != GLFW_RELEASE && scene.alive(controlTarget))
+            scene.meshes[scene.mesh[scene.indexOf(controlTarget)]].nSegments++;
         break;
     case GLFW_KEY_DOWN:
-        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+        if (action != GLFW_RELEASE && scene.alive(controlTarget))
         {
-            if (global_nSegments[controlTarget] > 3)
-                prev_nSegments[controlTarget] = global_nSegments[controlTarget]--;
+            Mesh &mesh = scene.meshes[scene.mesh[scene.indexOf(controlTarget)]];
+            if (mesh.nSegments > 3)
+                mesh.nSegments--;
         }
         break;
     default:
@@ -450,6 +1555,15 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
 {
+    if (inputRecorder)
+    {
+        InputEvent event;
+        event.type = InputEvent::CURSOR;
+        event.time = static_cast<float>(glfwGetTime());
+        event.x = static_cast<float>(xposIn);
+        event.y = static_cast<float>(yposIn);
+        inputRecorder->record(event);
+    }
     float xpos = static_cast<float>(xposIn);
     float ypos = static_cast<float>(yposIn);
 
@@ -473,10 +1587,39 @@ void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 {
+    if (inputRecorder)
+    {
+        InputEvent event;
+        event.type = InputEvent::SCROLL;
+        event.time = static_cast<float>(glfwGetTime());
+        event.y = static_cast<float>(yoffset);
+        inputRecorder->record(event);
+    }
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
-void generateSphere(int nSegments, std::vector<float> &vertices, std::vector<int> &indices)
+// glfw: a left click selects the object under the crosshair (the view center)
+// ---------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow *, int button, int action, int mods)
+{
+    if (inputRecorder)
+    {
+        InputEvent event;
+        event.type = InputEvent::BUTTON;
+        event.time = static_cast<float>(glfwGetTime());
+        event.a = button;
+        event.b = action;
+        event.c = mods;
+        inputRecorder->record(event);
+    }
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+        return;
+    Scene::Handle picked = scene.pick(camera.Position, camera.Front, SCENE_SELECTABLE);
+    if (scene.alive(picked))
+        controlTarget = picked;
+}
+
+void generateSphere(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds)
 {
     vertices.clear();
     indices.clear();
@@ -512,9 +1655,15 @@ void generateSphere(int nSegments, std::vector<float> &vertices, std::vector<int
             indices.push_back((i + 1) * (nSegments + 1) + j + 1);
         }
     }
+
+    // 包围盒与包围球
+    bounds.min = glm::vec3(-1.0f);
+    bounds.max = glm::vec3(1.0f);
+    bounds.center = glm::vec3(0.0f);
+    bounds.radius = 1.0f;
 }
 
-void generateCone(int nSegments, std::vector<float> &vertices, std::vector<int> &indices)
+void generateCone(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds)
 {
     vertices.clear();
     indices.clear();
@@ -578,9 +1727,16 @@ void generateCone(int nSegments, std::vector<float> &vertices, std::vector<int>
         indices.push_back(i + nSegments + 2);
         indices.push_back(i + 1 + nSegments + 2);
     }
+
+    // 包围盒与包围球: the smallest sphere through the apex and the base rim
+    float c = (h * h - 1.0f) / (2.0f * h);
+    bounds.min = glm::vec3(-1.0f, 0.0f, -1.0f);
+    bounds.max = glm::vec3(1.0f, h, 1.0f);
+    bounds.center = glm::vec3(0.0f, c, 0.0f);
+    bounds.radius = h - c;
 }
 
-void generateCylinder(int nSegments, std::vector<float> &vertices, std::vector<int> &indices)
+void generateCylinder(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds)
 {
     vertices.clear();
     indices.clear();
@@ -671,9 +1827,15 @@ void generateCylinder(int nSegments, std::vector<float> &vertices, std::vector<i
         indices.push_back(i + 1 + 3 * nSegments + 4);
         indices.push_back(i + 3 * nSegments + 4);
     }
+
+    // 包围盒与包围球
+    bounds.min = glm::vec3(-1.0f, 0.0f, -1.0f);
+    bounds.max = glm::vec3(1.0f, h, 1.0f);
+    bounds.center = glm::vec3(0.0f, 0.5f * h, 0.0f);
+    bounds.radius = std::sqrt(1.0f + 0.25f * h * h);
 }
 
-void generatePolyhedron(int nSegments, std::vector<float> &vertices, std::vector<int> &indices)
+void generatePolyhedron(int nSegments, std::vector<float> &vertices, std::vector<int> &indices, Bounds &bounds)
 {
     vertices.clear();
     indices.clear();
@@ -784,52 +1946,293 @@ void generatePolyhedron(int nSegments, std::vector<float> &vertices, std::vector
         indices.push_back(i + 1 + 5 * nSegments + 2);
         indices.push_back(i + 5 * nSegments + 2);
     }
+
+    // 包围盒与包围球
+    bounds.min = glm::vec3(-1.0f, 0.0f, -1.0f);
+    bounds.max = glm::vec3(1.0f, h, 1.0f);
+    bounds.center = glm::vec3(0.0f, 0.5f * h, 0.0f);
+    bounds.radius = std::sqrt(1.0f + 0.25f * h * h);
+}
+
+// the four selectable objects, the floor plane and one sphere per light
+void buildScene()
+{
+    MeshGenerator generators[] = {generateCylinder, generateSphere, generateCone, generatePolyhedron};
+    int segments[] = {50, 50, 50, 4};
+    Material materials[] = {
+        {glm::vec3(0.0f,0.1f,0.06f), glm::vec3(0.0f,0.5098f,0.5098f), glm::vec3(0.5020f,0.5020f,0.5020f), 1.0f},
+        {glm::vec3(0.0f,0.0f,0.0f), glm::vec3(0.1f,0.35f,0.1f), glm::vec3(0.45f,0.55f,0.45f), 1.0f},
+        {glm::vec3(0.0f,0.0f,0.0f), glm::vec3(0.5f,0.5f,0.0f), glm::vec3(0.6f,0.6f,0.5f), 1.0f},
+        {glm::vec3(0.2f,0.0f,0.0f), glm::vec3(0.8f,0.0f,0.0f), glm::vec3(0.7f,0.6f,0.6f), 0.8f}
+    };
+    float objScale = 0.5f;
+    glm::vec3 positions[] = {
+        glm::vec3(-1.0f, 0.0f, -1.0f),
+        glm::vec3(1.0f, objScale, -1.0f),
+        glm::vec3(-1.0f, 0.0f, 1.0f),
+        glm::vec3(1.0f, 0.0f, 1.0f)
+    };
+
+    // the plane is drawn first, as before
+    Mesh plane = Mesh();
+    plane.vertices = planeVertices;
+    for (int i = 0; i < (int)planeVertices.size() / 6; ++i)
+        plane.indices.push_back(i);
+    plane.bounds = Bounds::fromVertices(plane.vertices, 6);
+    Material planeMaterial = {glm::vec3(0.0f,0.0f,0.0f), glm::vec3(0.8f,0.8f,0.8f), glm::vec3(0.5f,0.5f,0.5f), 1.0f};
+    scene.create(scene.addMesh(plane), scene.addMaterial(planeMaterial), glm::vec3(0.0f, -0.12f, 0.0f), 1.0f, SCENE_LIT | SCENE_CASTS_SHADOW | SCENE_OCCLUDER);
+
+    uint32_t meshIds[4], materialIds[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        Mesh mesh = Mesh();
+        mesh.generate = generators[i];
+        mesh.nSegments = benchSegments > 0 ? benchSegments : sceneSegments > 0 ? sceneSegments : segments[i];
+        meshIds[i] = i < sceneInstances ? scene.addMesh(mesh) : 0;
+        materialIds[i] = i < sceneInstances ? scene.addMaterial(materials[i]) : 0;
+    }
+    // sceneInstances objects, the four primitives in turn sharing their mesh
+    // and material; past four they stand on a square grid two units apart.
+    // The first four are the ones the keys and batch jobs select
+    int side = (int)std::ceil(std::sqrt((double)sceneInstances));
+    for (int i = 0; i < sceneInstances; ++i)
+    {
+        int kind = i % 4;
+        glm::vec3 position = positions[kind];
+        if (sceneInstances > 4)
+            position = glm::vec3(2.0f * (i % side) - (side - 1), positions[kind].y, 2.0f * (i / side) - (side - 1));
+        uint32_t flags = SCENE_LIT | SCENE_CASTS_SHADOW | SCENE_OCCLUDER;
+        Scene::Handle object = scene.create(meshIds[kind], materialIds[kind], position, objScale, i < 4 ? flags | SCENE_SELECTABLE : flags);
+        if (i < 4)
+            selectable.push_back(object);
+    }
+    controlTarget = selectable[0];
+
+    // light sources share one sphere mesh
+    Mesh lightMesh = Mesh();
+    lightMesh.generate = generateSphere;
+    lightMesh.nSegments = 50;
+    uint32_t lightMeshId = scene.addMesh(lightMesh);
+    uint32_t lightMaterial = scene.addMaterial(planeMaterial);
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+        lightEntities[i] = scene.create(lightMeshId, lightMaterial, lightPos[i], 0.2f, i < activeLights ? (uint32_t)SCENE_EMISSIVE : 0u);
+}
+
+// (re)generate a mesh and its bounds if needed and upload it
+void uploadMesh(Mesh &mesh)
+{
+    if (mesh.generate)
+    {
+        mesh.generate(mesh.nSegments, mesh.vertices, mesh.indices, mesh.bounds);
+        mesh.builtSegments = mesh.nSegments;
+        // a low-segment version for the software occlusion; its vertices lie
+        // on the same surface, so it covers no more than the mesh does
+        // beyond the tessellation error
+        Bounds occluderBounds;
+        mesh.generate(std::min(mesh.nSegments, OCCLUDER_SEGMENTS), mesh.occluderVertices, mesh.occluderIndices, occluderBounds);
+    }
+    else
+    {
+        mesh.occluderVertices = mesh.vertices;
+        mesh.occluderIndices = mesh.indices;
+    }
+
+    // the previous version's space returns to the arenas first, so a mesh
+    // of the same size or smaller lands in it again
+    vertexArena->release(mesh.vertexAllocation);
+    indexArena->release(mesh.indexAllocation);
+    mesh.vertexAllocation = vertexArena->allocate(mesh.vertices.size() * sizeof(float) / VERTEX_STRIDE, mesh.vertices.data());
+    mesh.indexAllocation = indexArena->allocate(mesh.indices.size(), mesh.indices.data());
+    bindMeshArenas();
+}
+
+// point the mesh vertex array at the arena buffers, again after one grew
+void bindMeshArenas()
+{
+    if (vertexArena->buffer() != meshVertexBuffer)
+    {
+        meshVertexBuffer = vertexArena->buffer();
+        // position attribute
+        setVertexAttribute(meshVAO, 0, meshVertexBuffer, 3, GL_FLOAT, VERTEX_STRIDE, 0);
+        // normal attribute
+        setVertexAttribute(meshVAO, 1, meshVertexBuffer, 3, GL_FLOAT, VERTEX_STRIDE, 3 * sizeof(float));
+    }
+    if (indexArena->buffer() != meshIndexBuffer)
+    {
+        meshIndexBuffer = indexArena->buffer();
+        setElementBuffer(meshVAO, meshIndexBuffer);
+    }
+}
+
+// move the animated entities and rebuild every matrix and bound in one batch
+void updateTransforms(const glm::mat4 *viewProjections, int viewCount)
+{
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+        scene.setPosition(lightEntities[i], lightPos[i]);
+    scene.transforms.update(viewProjections, viewCount);
+    scene.updateBounds();
+}
+
+// test every entity against each view's frustum
+void cullScene(const glm::mat4 *viewProjections, int viewCount)
+{
+    BoundsArrays bounds = scene.boundsArrays();
+    for (int v = 0; v < viewCount; ++v)
+    {
+        visibility[v].resize(scene.size());
+        cullStats[v].tested = scene.size();
+        cullStats[v].visible = FrustumCuller::cull(Frustum::fromMatrix(viewProjections[v]), bounds, scene.size(), visibility[v].data());
+    }
 }
 
-// render the plane and objects
-void renderObjects(Shader &shader, unsigned int objVAO[], unsigned int planeVAO, int target)
+// lights, shadow matrices and view settings of the lit fragment stages
+void setLightUniforms(Shader &shader, const glm::mat4 *lightSpaceMatrixs)
 {
     shader.use();
-    glm::mat4 model = glm::mat4(1.0f);
-
-    if(target!=-1){
-        model = glm::translate(model, objPosition[target]);
-        model = glm::scale(model, glm::vec3(objScale));
-        shader.setVec3("material.ambient", materialAmbient[target]);
-        shader.setVec3("material.diffuse", materialDiffuse[target]);
-        shader.setVec3("material.specular", materialSpecular[target]);
-        shader.setFloat("material.alpha", materialAlpha[target]);
-        shader.setMat4("model", model);
-        glBindVertexArray(objVAO[target]);
-        glDrawElements(GL_TRIANGLES, objectIndices[target].size(), GL_UNSIGNED_INT, 0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        return;
+    shader.setInt("lightCount", activeLights);
+    for(int i=0;i<activeLights;++i){
+        shader.setMat4("lightSpaceMatrixs["+std::to_string(i)+"]", lightSpaceMatrixs[i]);
+        // light properties
+        shader.setVec3("lights["+std::to_string(i)+"].position", lightPos[i]);
+        shader.setVec3("lights["+std::to_string(i)+"].ambient", 0.2f, 0.2f, 0.2f);
+        shader.setVec3("lights["+std::to_string(i)+"].diffuse", 0.8f, 0.8f, 0.8f);
+        shader.setVec3("lights["+std::to_string(i)+"].specular", 1.0f, 1.0f, 1.0f);
+        shader.setFloat("lights["+std::to_string(i)+"].constant", 1.0f);
+        shader.setFloat("lights["+std::to_string(i)+"].linear", 0.09f);
+        shader.setFloat("lights["+std::to_string(i)+"].quadratic", 0.032f);
     }
+    shader.setVec3("viewPos", camera.Position);
+    shader.setFloat("material.shininess", 32.0f);
+    shader.setFloat("shininess", 32.0f);
+    shader.setBool("blinn", blinn);
+}
 
-    // render plane
-    model = glm::translate(model, glm::vec3(0.0f, -0.12f, 0.0f));
-    shader.setVec3("material.ambient", materialAmbient[4]);
-    shader.setVec3("material.diffuse", materialDiffuse[4]);
-    shader.setVec3("material.specular", materialSpecular[4]);
-    shader.setMat4("model", model);
-    glBindVertexArray(planeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, planeVertices.size());
+void setMaterial(Shader &shader, const Material &material)
+{
+    shader.setVec3("material.ambient", material.ambient);
+    shader.setVec3("material.diffuse", material.diffuse);
+    shader.setVec3("material.specular", material.specular);
+    shader.setFloat("material.alpha", material.alpha);
+}
 
-    // render objects
-    for (int i = 0; i < 4; ++i)
+// matrices of entity i as seen from the given view, then its draw call
+void drawInstance(Shader &shader, int view, size_t i)
+{
+    shader.setMat4("model", scene.transforms.world[i]);
+    shader.setMat4("mvp", scene.transforms.getMVP(view, i));
+    shader.setMat3("normalMatrix", glm::mat3(scene.transforms.normal[i]));
+    const Mesh &mesh = scene.meshes[scene.mesh[i]];
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, (void *)indexArena->byteOffset(mesh.indexAllocation),
+                             (GLint)vertexArena->first(mesh.vertexAllocation));
+}
+
+// material, matrices and mesh of entity i as seen from the given view
+void drawEntity(Shader &shader, int view, size_t i)
+{
+    setMaterial(shader, scene.materials[scene.material[i]]);
+    glState.bindVertexArray(meshVAO);
+    drawInstance(shader, view, i);
+}
+
+// emit a sort key for every visible entity of a pass into the render queue
+// and sort it; opaque passes order by depth front to back, the others only
+// by state
+void queueObjects(RenderPass pass, int view, uint32_t mask, uint32_t exclude)
+{
+    const AlignedVector<uint8_t> &visible = visibility[view];
+    const bool frontToBack = pass == PASS_SHADOW || pass == PASS_DEPTH_PREPASS || pass == PASS_OPAQUE;
+    renderQueue.clear();
+    renderQueue.emit(scene.size(), [&](size_t i, RenderQueue::Bucket &bucket) {
+        if (!(scene.flags[i] & mask) || (scene.flags[i] & exclude) || !visible[i])
+            return;
+        // clip w of the entity's origin: its distance along the view direction
+        float depth = frontToBack ? scene.transforms.getMVP(view, i)[3][3] : 0.0f;
+        bucket.push_back({RenderQueue::makeKey(pass, depth, scene.material[i], scene.mesh[i]), (uint32_t)i});
+    });
+    renderQueue.sort();
+}
+
+// draw the queue in key order with shader, binding material and mesh only
+// when they change
+void submitQueue(Shader &shader, int view)
+{
+    uint32_t boundMaterial = UINT32_MAX, boundMesh = UINT32_MAX;
+    if (!renderQueue.sorted().empty())
+    {
+        shader.use();
+        ++queueStats.programBinds;
+    }
+    for (const RenderQueue::Item &item : renderQueue.sorted())
+    {
+        size_t i = item.entity;
+        if (scene.material[i] != boundMaterial)
+        {
+            setMaterial(shader, scene.materials[scene.material[i]]);
+            boundMaterial = scene.material[i];
+            ++queueStats.materialBinds;
+        }
+        else
+            ++queueStats.materialSkipped;
+        if (scene.mesh[i] != boundMesh)
+        {
+            // every mesh shares the arena vertex array, so the cache drops this
+            // bind; a mesh change costs only the draw's offsets
+            glState.bindVertexArray(meshVAO);
+            boundMesh = scene.mesh[i];
+            ++queueStats.meshBinds;
+        }
+        else
+            ++queueStats.meshSkipped;
+        drawInstance(shader, view, i);
+        ++queueStats.draws;
+    }
+}
+
+// render every visible entity with one of the mask's flags and none of the
+// exclude flags, or only the target
+void renderObjects(RenderPass pass, Shader &shader, int view, uint32_t mask, Scene::Handle target, uint32_t exclude)
+{
+    if (target != Scene::Handle())
     {
-        // material properties
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, objPosition[i]);
-        model = glm::scale(model, glm::vec3(objScale));
-        shader.setVec3("material.ambient", materialAmbient[i]);
-        shader.setVec3("material.diffuse", materialDiffuse[i]);
-        shader.setVec3("material.specular", materialSpecular[i]);
-        shader.setFloat("material.alpha", materialAlpha[i]);
-        shader.setMat4("model", model);
-        glBindVertexArray(objVAO[i]);
-        glDrawElements(GL_TRIANGLES, objectIndices[i].size(), GL_UNSIGNED_INT, 0);
-    }
-        
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        shader.use();
+        if (scene.alive(target) && (scene.flags[scene.indexOf(target)] & mask) && visibility[view][scene.indexOf(target)])
+        {
+            drawEntity(shader, view, scene.indexOf(target));
+            ++queueStats.draws;
+        }
+        return;
+    }
+
+    queueObjects(pass, view, mask, exclude);
+    submitQueue(shader, view);
+}
+
+// average GPU time of one main pass with rasterization discarded, so only the
+// vertex stage is measured
+double timeVertexStage(Shader &shader, const glm::mat4 &projection, const glm::mat4 &view, int iterations)
+{
+    shader.use();
+    shader.setMat4("projection", projection);
+    shader.setMat4("view", view);
+
+    glm::mat4 viewProjection = projection * view;
+    updateTransforms(&viewProjection, 1);
+    cullScene(&viewProjection, 1);
+
+    unsigned int query;
+    glGenQueries(1, &query);
+    glEnable(GL_RASTERIZER_DISCARD);
+    // warm up so shader compilation is not timed
+    renderObjects(PASS_OPAQUE, shader, 0, SCENE_LIT);
+    glFinish();
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < iterations; ++i)
+        renderObjects(PASS_OPAQUE, shader, 0, SCENE_LIT);
+    glEndQuery(GL_TIME_ELAPSED);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    glDeleteQueries(1, &query);
+    return elapsed / 1.0e6 / iterations;
 }
\ No newline at end of file